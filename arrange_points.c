@@ -0,0 +1,692 @@
+/*
+ * Copyright (C) 2017 Santiago León O. <santileortiz@gmail.com>
+ */
+
+// The following is an implementation of an algorithm that positions the points
+// in a point set automatically into a more friendly configuration than the one
+// found in the database. A more in depth discussion about it's design can be
+// found in the file auto_positioning_points.txt.
+
+// Computes the force between two points proportional to the difference in their
+// distance and length. When adding the resulting vector to a and it's inverse
+// to b it effectively moves points closer to being at distance length. The
+// value h is a positive value that determines the strength of the force.
+dvec2 spring_force_pts (dvec2 a, dvec2 b, double length, double h)
+{
+    dvec2 res;
+    dvec2 force = dvec2_subs (b, a);
+    double d = dvec2_norm (force);
+    if (d > 0) {
+        dvec2_normalize (&force);
+        res = dvec2_mult (force, h*(d-length));
+    } else {
+        res = DVEC2(0,0);
+    }
+    return res;
+}
+
+dvec2 spring_force (dvec2 *points, int a, int b, double length, double h)
+{
+    dvec2 p = points[a];
+    dvec2 p_next = points[b];
+    return spring_force_pts (p, p_next, length, h);
+}
+
+// Computes the combinatorial information about _ot_ used by the algorithm.
+// _sort_ must have space for n*(n-1) integers and _cvx_hull_ for n.
+void arrange_points_precompute (order_type_t *ot, int *sort, int *cvx_hull, int *cvx_hull_len)
+{
+    int len = ot->n;
+    int *sort_ptr = sort;
+    int i;
+    for (i=0; i<len; i++) {
+        sort_all_points_p (ot, i, 0, sort_ptr);
+        sort_ptr += len-1;
+    }
+
+    convex_hull (ot, cvx_hull, cvx_hull_len);
+}
+
+// Parameters of ARRANGE_POINTS_ADAPTIVE, see arrange_points_step_adaptive().
+#define ARRANGE_ADAPTIVE_DT_INC 1.5
+#define ARRANGE_ADAPTIVE_DT_DEC 0.5
+#define ARRANGE_ADAPTIVE_DT_MAX 16.0
+
+// NOTE: _sort_ and _cvx_hull_ are the ones computed by
+// arrange_points_precompute(), they are not copied so they must outlive
+// _alg_st_.
+void arrange_points_start (struct arrange_points_state_t *alg_st, order_type_t *ot, dvec2 *points,
+                           int *sort, int *cvx_hull, int cvx_hull_len,
+                           enum arrange_points_mode_t mode)
+{
+    int len = ot->n;
+    *alg_st = (struct arrange_points_state_t){0};
+    alg_st->mode = mode;
+    alg_st->ot = ot;
+    alg_st->sort = sort;
+    alg_st->cvx_hull = cvx_hull;
+    alg_st->cvx_hull_len = cvx_hull_len;
+
+    dvec2 cvx_hull_v2[len];
+    dvec2_idx_to_array (points, alg_st->cvx_hull, cvx_hull_v2, alg_st->cvx_hull_len);
+    alg_st->centroid = polygon_centroid (cvx_hull_v2, alg_st->cvx_hull_len);
+
+    alg_st->tgt_hull = mem_pool_push_size(&alg_st->pool, sizeof(dvec2)*alg_st->cvx_hull_len);
+    convex_point_set_radius (alg_st->cvx_hull_len, 0,
+                             points[alg_st->cvx_hull[0]], alg_st->centroid,
+                             alg_st->tgt_hull);
+    alg_st->tgt_radius = dvec2_norm (dvec2_subs(points[alg_st->cvx_hull[0]], alg_st->centroid));
+    alg_st->steps = 0;
+
+    orientation_validator_init (&alg_st->validator, chirotope_new (ot, &alg_st->pool),
+                                points, &alg_st->pool);
+    if (mode == ARRANGE_POINTS_ADAPTIVE) {
+        alg_st->force = mem_pool_push_size (&alg_st->pool, sizeof(dvec2)*len);
+        alg_st->validated = mem_pool_push_size (&alg_st->pool, sizeof(dvec2)*len);
+        memcpy (alg_st->validated, points, sizeof(dvec2)*len);
+        alg_st->dt = 1;
+    }
+}
+
+// Returns true if the resulting point set is good enough to show to the user.
+// If _max_coord_ is not 0, points are scaled down so that after rounding their
+// coordinates are between 0 and _max_coord_.
+bool arrange_points_end (struct arrange_points_state_t *alg_st, dvec2 *points, int len, double max_coord)
+{
+    bool res = true;
+    int i;
+    if (max_coord > 0) {
+        box_t box;
+        get_bounding_box (points, len, &box);
+        double extent = MAX (box.max.x - box.min.x, box.max.y - box.min.y);
+        if (extent > max_coord) {
+            for (i=0; i < len; i++) {
+                dvec2_subs_to (&points[i], DVEC2(box.min.x, box.min.y));
+                dvec2_mult_to (&points[i], max_coord/extent);
+            }
+        }
+    }
+
+    for (i=0; i < len; i++) {
+        dvec2_round (&points[i]);
+    }
+
+    box_t box;
+    get_bounding_box (points, len, &box);
+
+    for (i=0; i < len; i++) {
+        dvec2_subs_to (&points[i], DVEC2(box.min.x, box.min.y));
+    }
+
+    if (orientation_validator_reset (&alg_st->validator, points) != 0) {
+        res = false;
+    }
+
+    mem_pool_destroy(&alg_st->pool);
+    return res;
+}
+
+// Adds the force of the circular wall to the forces in _res_.
+void arrange_points_wall_force (struct arrange_points_state_t *alg_st, dvec2 *points, dvec2 *res)
+{
+    int i;
+    for (i=0; i<alg_st->cvx_hull_len; i++) {
+        dvec2 r = dvec2_subs (points[alg_st->cvx_hull[i]], alg_st->centroid);
+        double dist = dvec2_norm(r) - alg_st->tgt_radius;
+        if (dist > 0) {
+            dvec2_normalize (&r);
+            double norm = dvec2_dot (res[alg_st->cvx_hull[i]], r);
+            dvec2_mult_to (&r, -(norm + 0.01*dist));
+            dvec2_add_to (&res[alg_st->cvx_hull[i]], r);
+        }
+    }
+}
+
+// Moves the points by the vectors in _res_ and returns the change indicator.
+double arrange_points_move (struct arrange_points_state_t *alg_st, dvec2 *points, int len, dvec2 *res)
+{
+    int i;
+    //for (i=0; i<len; i++) {
+    //    dvec2_print (&res[i]);
+    //}
+
+    double change = 0;
+    dvec2 old_p_0 = points[0];
+    dvec2_add_to (&points[0], res[0]);
+    //dvec2_print (&res[0]);
+    for (i=1; i<len; i++) {
+        double old_dist = dvec2_distance (&old_p_0, &points[i]);
+        dvec2_add_to (&points[i], res[i]);
+        //dvec2_print (&res[i]);
+        double new_dist = dvec2_distance (&points[0], &points[i]);
+        change = MAX(change, fabs(old_dist-new_dist));
+    }
+
+    return change*75/alg_st->tgt_radius;
+}
+
+// Vectorized step
+//
+// For each point v, every other point p gets an angular force perpendicular
+// to vp that moves it towards the bisector of the angle between its neighbors
+// s_m and s_p in the order around v. Instead of two acos() for each of the
+// n*(n-1) angular forces, for each point v we compute once the angle of the
+// vectors from v to the rest of the points, in the order they have around v.
+// Clockwise angles between consecutive vectors are differences of these. The
+// angles are computed with an approximation of atan2() that is evaluated 4 at
+// a time with AVX2 when available.
+//
+// NOTE: The approximation has a maximum error of about 1e-5 radians, way
+// below the angles that matter to the algorithm, convergence is the same as
+// with the exact angles.
+
+#define ARRANGE_ANGLES_KERNEL(name) void name(double *dx, double *dy, double *theta, double *r, int len)
+typedef ARRANGE_ANGLES_KERNEL(arrange_angles_kernel_t);
+
+// Minimax polynomial for atan(z) with z in [0,1].
+#define FAST_ATAN_C1  0.99997726
+#define FAST_ATAN_C3 -0.33262347
+#define FAST_ATAN_C5  0.19354346
+#define FAST_ATAN_C7 -0.11643287
+#define FAST_ATAN_C9  0.05265332
+#define FAST_ATAN_C11 -0.01172120
+
+double fast_atan2 (double y, double x)
+{
+    double ax = fabs (x), ay = fabs (y);
+    double mx = MAX (ax, ay), mn = MIN (ax, ay);
+    double z = mx > 0 ? mn/mx : 0;
+    double z2 = z*z;
+    double t = z*(FAST_ATAN_C1 + z2*(FAST_ATAN_C3 + z2*(FAST_ATAN_C5 +
+               z2*(FAST_ATAN_C7 + z2*(FAST_ATAN_C9 + z2*FAST_ATAN_C11)))));
+    if (ay > ax) t = M_PI/2 - t;
+    if (x < 0) t = M_PI - t;
+    if (y < 0) t = -t;
+    return t;
+}
+
+ARRANGE_ANGLES_KERNEL(arrange_angles_scalar)
+{
+    int i;
+    for (i=0; i<len; i++) {
+        theta[i] = fast_atan2 (dy[i], dx[i]);
+        r[i] = sqrt (dx[i]*dx[i] + dy[i]*dy[i]);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+ARRANGE_ANGLES_KERNEL(arrange_angles_avx2)
+{
+    __m256d sign_mask = _mm256_set1_pd (-0.0);
+    __m256d zero = _mm256_setzero_pd ();
+    __m256d half_pi = _mm256_set1_pd (M_PI/2);
+    __m256d pi = _mm256_set1_pd (M_PI);
+    int i = 0;
+    for (; i+4 <= len; i+=4) {
+        __m256d x = _mm256_loadu_pd (dx + i);
+        __m256d y = _mm256_loadu_pd (dy + i);
+        __m256d ax = _mm256_andnot_pd (sign_mask, x);
+        __m256d ay = _mm256_andnot_pd (sign_mask, y);
+        __m256d mx = _mm256_max_pd (ax, ay);
+        __m256d mn = _mm256_min_pd (ax, ay);
+        __m256d z = _mm256_div_pd (mn, mx);
+        z = _mm256_blendv_pd (z, zero, _mm256_cmp_pd (mx, zero, _CMP_EQ_OQ));
+
+        __m256d z2 = _mm256_mul_pd (z, z);
+        __m256d t = _mm256_set1_pd (FAST_ATAN_C11);
+        t = _mm256_add_pd (_mm256_mul_pd (t, z2), _mm256_set1_pd (FAST_ATAN_C9));
+        t = _mm256_add_pd (_mm256_mul_pd (t, z2), _mm256_set1_pd (FAST_ATAN_C7));
+        t = _mm256_add_pd (_mm256_mul_pd (t, z2), _mm256_set1_pd (FAST_ATAN_C5));
+        t = _mm256_add_pd (_mm256_mul_pd (t, z2), _mm256_set1_pd (FAST_ATAN_C3));
+        t = _mm256_add_pd (_mm256_mul_pd (t, z2), _mm256_set1_pd (FAST_ATAN_C1));
+        t = _mm256_mul_pd (t, z);
+
+        t = _mm256_blendv_pd (t, _mm256_sub_pd (half_pi, t), _mm256_cmp_pd (ay, ax, _CMP_GT_OQ));
+        t = _mm256_blendv_pd (t, _mm256_sub_pd (pi, t), _mm256_cmp_pd (x, zero, _CMP_LT_OQ));
+        t = _mm256_blendv_pd (t, _mm256_sub_pd (zero, t), _mm256_cmp_pd (y, zero, _CMP_LT_OQ));
+        _mm256_storeu_pd (theta + i, t);
+
+        __m256d r2 = _mm256_add_pd (_mm256_mul_pd (x, x), _mm256_mul_pd (y, y));
+        _mm256_storeu_pd (r + i, _mm256_sqrt_pd (r2));
+    }
+    arrange_angles_scalar (dx + i, dy + i, theta + i, r + i, len - i);
+}
+#endif
+
+arrange_angles_kernel_t *g_arrange_angles = NULL;
+
+void arrange_angles_init ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) {
+        g_arrange_angles = arrange_angles_avx2;
+        return;
+    }
+#endif
+    g_arrange_angles = arrange_angles_scalar;
+}
+
+// Clockwise angle from the vector with angle _theta_1_ to the one with angle
+// _theta_2_, in the range [0, 2*M_PI).
+static inline
+double cw_angle (double theta_1, double theta_2)
+{
+    double res = theta_1 - theta_2;
+    return res < 0 ? res + 2*M_PI : res;
+}
+
+// Adds the angular forces of all points to _res_.
+void arrange_points_angular_forces (struct arrange_points_state_t *alg_st, dvec2 *points, int len, dvec2 *res)
+{
+    if (g_arrange_angles == NULL) {
+        arrange_angles_init ();
+    }
+
+    int m = len-1;
+    double dx[m], dy[m], theta[m], r[m];
+    double magnitude = alg_st->tgt_radius/(30*len);
+    int v;
+    for (v=0; v<len; v++) {
+        int *pts_arnd_v = &alg_st->sort[v*m];
+        int k;
+        for (k=0; k<m; k++) {
+            dx[k] = points[pts_arnd_v[k]].x - points[v].x;
+            dy[k] = points[pts_arnd_v[k]].y - points[v].y;
+        }
+        g_arrange_angles (dx, dy, theta, r, m);
+
+        // Angular force on p = pts_arnd_v[k], between s_m = pts_arnd_v[k-1]
+        // and s_p = pts_arnd_v[k+1].
+        for (k=0; k<m; k++) {
+            int k_m = k == 0 ? m-1 : k-1;
+            int k_p = k+1 == m ? 0 : k+1;
+
+            double ang_a = cw_angle (theta[k_m], theta[k]);
+            double ang_b = cw_angle (theta[k], theta[k_p]);
+            if (ang_a + ang_b >= 2*M_PI) {
+                // NOTE: p is not in the cone between s_m and s_p.
+                double ang_c = cw_angle (theta[k_m], theta[k_p]);
+                double ang_p_s_p = cw_angle (theta[k_p], theta[k]);
+                if (ang_p_s_p < (2*M_PI-ang_c)/2) {
+                    ang_b = -MIN (ang_p_s_p, 2*M_PI - ang_p_s_p);
+                } else {
+                    ang_a = -MIN (ang_a, 2*M_PI - ang_a);
+                }
+            }
+
+            // Clockwise perpendicular to vp, scaled.
+            double coef = (ang_b-ang_a)/(ang_a+ang_b)*magnitude/r[k];
+            int p = pts_arnd_v[k];
+            res[p].x += dy[k]*coef;
+            res[p].y -= dx[k]*coef;
+        }
+    }
+}
+
+double arrange_points_step_adaptive (struct arrange_points_state_t *alg_st, dvec2 *points, int len);
+
+double arrange_points_step (struct arrange_points_state_t *alg_st, dvec2 *points, int len)
+{
+    if (alg_st->mode == ARRANGE_POINTS_ADAPTIVE) {
+        return arrange_points_step_adaptive (alg_st, points, len);
+    }
+    alg_st->steps++;
+
+    dvec2 res[len];
+    int i;
+    for (i=0; i<len; i++) {
+        res[i] = (dvec2){0};
+    }
+
+    arrange_points_angular_forces (alg_st, points, len, res);
+    arrange_points_wall_force (alg_st, points, res);
+    return arrange_points_move (alg_st, points, len, res);
+}
+
+// Adaptive step mode
+//
+// Fixed step integration takes many steps because the force magnitude is
+// conservative, it must not overshoot in the worst case. In this mode the
+// forces are scaled by a step size _dt_ that grows after each accepted step.
+// A step larger than the fixed one is rolled back and retried with half the
+// step size if it overshoots, that is, the change indicator after it is larger
+// than before, or if it increases the number of triples with an orientation
+// different than in _ot_.
+//
+// NOTE: Momentum based methods like FIRE don't work here, angular forces are
+// not the gradient of an energy, so the velocity keeps the point set rotating
+// instead of converging.
+
+// Computes the forces on _points_ into _force_ and returns the change
+// indicator of the fixed step mode.
+double arrange_points_forces (struct arrange_points_state_t *alg_st, dvec2 *points, int len, dvec2 *force)
+{
+    int i;
+    for (i=0; i<len; i++) {
+        force[i] = (dvec2){0};
+    }
+    arrange_points_angular_forces (alg_st, points, len, force);
+    arrange_points_wall_force (alg_st, points, force);
+
+    dvec2 tmp_points[len];
+    memcpy (tmp_points, points, len*sizeof(dvec2));
+    return arrange_points_move (alg_st, tmp_points, len, force);
+}
+
+// Updates the orientation validator to _points_ and returns the number of
+// violations. Only the points that moved since the last update are passed to
+// orientation_validator_move(). Each call recomputes about n^2/2 triples, so
+// when a third of the points or more moved all orientations are recomputed
+// instead.
+uint32_t arrange_points_validate (struct arrange_points_state_t *alg_st, dvec2 *points, int len)
+{
+    int moved[len];
+    int num_moved = 0;
+    int i;
+    for (i=0; i<len; i++) {
+        if (points[i].x != alg_st->validated[i].x || points[i].y != alg_st->validated[i].y) {
+            moved[num_moved++] = i;
+        }
+    }
+
+    if (3*num_moved >= len) {
+        orientation_validator_reset (&alg_st->validator, points);
+    } else {
+        for (i=0; i<num_moved; i++) {
+            orientation_validator_move (&alg_st->validator, points, moved[i]);
+        }
+    }
+    memcpy (alg_st->validated, points, len*sizeof(dvec2));
+    return alg_st->validator.violations;
+}
+
+double arrange_points_step_adaptive (struct arrange_points_state_t *alg_st, dvec2 *points, int len)
+{
+    alg_st->steps++;
+
+    // NOTE: The forces of the current points were computed by the previous
+    // step, except for the first one.
+    dvec2 *force = alg_st->force;
+    if (alg_st->steps == 1) {
+        alg_st->change = arrange_points_forces (alg_st, points, len, force);
+    }
+
+    dvec2 old_points[len];
+    memcpy (old_points, points, len*sizeof(dvec2));
+
+    // NOTE: Orientations are only needed to decide if a step larger than the
+    // ones of the fixed step mode is accepted, the validator is not updated
+    // for the other steps.
+    uint32_t violations = 0;
+    if (alg_st->dt > 1) {
+        violations = arrange_points_validate (alg_st, points, len);
+    }
+
+    int i;
+    dvec2 new_force[len];
+    double new_change;
+    while (true) {
+        for (i=0; i<len; i++) {
+            points[i] = dvec2_add (old_points[i], dvec2_mult (force[i], alg_st->dt));
+        }
+
+        // NOTE: Steps not larger than the ones of the fixed step mode are
+        // always accepted, even if they change an orientation. The fixed step
+        // mode sometimes goes through a different order type and comes back.
+        if (alg_st->dt <= 1) {
+            new_change = arrange_points_forces (alg_st, points, len, new_force);
+            break;
+        }
+
+        uint32_t new_violations = arrange_points_validate (alg_st, points, len);
+
+        if (new_violations <= violations) {
+            new_change = arrange_points_forces (alg_st, points, len, new_force);
+            if (new_change <= alg_st->change) {
+                break;
+            }
+        }
+
+        memcpy (points, old_points, len*sizeof(dvec2));
+        alg_st->dt = MAX (1, alg_st->dt*ARRANGE_ADAPTIVE_DT_DEC);
+        alg_st->rollbacks++;
+    }
+
+    memcpy (force, new_force, len*sizeof(dvec2));
+    alg_st->change = new_change;
+    alg_st->dt = MIN (alg_st->dt*ARRANGE_ADAPTIVE_DT_INC, ARRANGE_ADAPTIVE_DT_MAX);
+    return new_change;
+}
+
+// Runs the algorithm on _ot_ starting from the points in the database, until
+// it converges or _max_steps_ steps are done. The result is left in _points_,
+// returns true if it has the same order type as _ot_. If _steps_ is not NULL
+// the number of steps done is stored there.
+bool arrange_points (order_type_t *ot, dvec2 *points, enum arrange_points_mode_t mode,
+                     uint64_t max_steps, double max_coord, uint64_t *steps)
+{
+    int n = ot->n;
+    int sort[n*(n-1)], cvx_hull[n], cvx_hull_len;
+    int i;
+    for (i=0; i<n; i++) {
+        points[i] = CAST_DVEC2(ot->pts[i]);
+    }
+    arrange_points_precompute (ot, sort, cvx_hull, &cvx_hull_len);
+
+    struct arrange_points_state_t alg_st;
+    arrange_points_start (&alg_st, ot, points, sort, cvx_hull, cvx_hull_len, mode);
+    double change;
+    do {
+        change = arrange_points_step (&alg_st, points, n);
+    } while (change > 0.01 && alg_st.steps < max_steps);
+
+    if (steps != NULL) {
+        *steps = alg_st.steps;
+    }
+
+    return arrange_points_end (&alg_st, points, n, max_coord);
+}
+
+// Arranged layouts database
+//
+// For each n there is a file otypesNN.arranged next to the order type
+// database, with the result of running the arrangement algorithm on every
+// order type:
+//
+//   struct arranged_db_header_t
+//   uint8_t valid[] // One bit per order type, padded to 8 bytes
+//   uint16_t coords[num_order_types][2*n]
+//
+// Order types where the algorithm didn't find a valid layout have their valid
+// bit unset, the viewer shows the database points for them.
+#define ARRANGED_DB_MAGIC 0x52524150 // "PARR"
+#define ARRANGED_DB_MAX_STEPS 20000
+
+struct arranged_db_header_t {
+    uint32_t magic;
+    uint32_t n;
+    uint64_t num_order_types;
+};
+
+#define arranged_db_valid_size(num_order_types) ((((num_order_types)+63)/64)*8)
+
+char* arranged_db_path (int n)
+{
+    char *location = __g_db_data.location != NULL ? __g_db_data.location : CONFIG_DIR;
+    char *dir_path = sh_expand (location, NULL);
+    char *full_path = malloc (strlen(dir_path)+strlen("otypesNN.arranged.tmp")+1);
+    sprintf (full_path, "%sotypes%02d.arranged", dir_path, n);
+    free (dir_path);
+    return full_path;
+}
+
+OT_DB_FOR_CB(arranged_db_build_ot)
+{
+    arranged_db_t *adb = (arranged_db_t*)closure;
+    int n = ot->n;
+
+    dvec2 points[n];
+    if (arrange_points (ot, points, ARRANGE_POINTS_ADAPTIVE, ARRANGED_DB_MAX_STEPS, UINT16_MAX, NULL)) {
+        uint16_t *coords = adb->coords + ot->id*2*n;
+        int i;
+        for (i=0; i<n; i++) {
+            coords[2*i] = points[i].x;
+            coords[2*i+1] = points[i].y;
+        }
+        __sync_fetch_and_or (&adb->valid[ot->id/8], 1 << (ot->id%8));
+    }
+}
+
+// Arranges all order types of size _n_ using _num_threads_ threads (or one
+// per processor if it's 0) and writes the result next to the database.
+bool arranged_db_build (int n, int num_threads)
+{
+    arranged_db_t adb = {0};
+    adb.n = n;
+    adb.num_order_types = db_num_order_types (n);
+    uint64_t valid_size = arranged_db_valid_size (adb.num_order_types);
+    uint64_t size = sizeof(struct arranged_db_header_t) + valid_size +
+        adb.num_order_types*2*n*sizeof(uint16_t);
+
+    char *path = arranged_db_path (n);
+    char tmp_path[strlen(path)+5];
+    sprintf (tmp_path, "%s.tmp", path);
+    int file = open (tmp_path, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    if (file == -1 || ftruncate (file, size) == -1) {
+        printf ("Could not create %s: %s\n", tmp_path, strerror(errno));
+        if (file != -1) {
+            close (file);
+        }
+        free (path);
+        return false;
+    }
+
+    // NOTE: The file is written through a shared mapping, so threads write
+    // directly to their order type's position.
+    uint8_t *map = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, file, 0);
+    if (map == MAP_FAILED) {
+        printf ("Could not map %s: %s\n", tmp_path, strerror(errno));
+        close (file);
+        free (path);
+        return false;
+    }
+    adb.valid = map + sizeof(struct arranged_db_header_t);
+    adb.coords = (uint16_t*)(adb.valid + valid_size);
+
+    ot_db_parallel_t par = {0};
+    ot_db_parallel_start (&par, n, num_threads, arranged_db_build_ot, &adb);
+    uint64_t processed;
+    while ((processed = ot_db_parallel_processed (&par)) < adb.num_order_types) {
+        printf ("\rArranging order types of size %d: %.2f%%", n, 100.0*processed/adb.num_order_types);
+        fflush (stdout);
+        usleep (100000);
+    }
+    ot_db_parallel_wait (&par);
+
+    uint64_t num_valid = 0, i;
+    for (i=0; i<valid_size; i++) {
+        num_valid += __builtin_popcount (adb.valid[i]);
+    }
+    printf ("\rArranged order types of size %d: %"PRIu64"/%"PRIu64" valid\n", n, num_valid, adb.num_order_types);
+
+    // NOTE: The header is written last, an interrupted build leaves an
+    // invalid file.
+    struct arranged_db_header_t *header = (struct arranged_db_header_t*)map;
+    header->magic = ARRANGED_DB_MAGIC;
+    header->n = n;
+    header->num_order_types = adb.num_order_types;
+
+    bool success = true;
+    if (msync (map, size, MS_SYNC) == -1 || rename (tmp_path, path) == -1) {
+        printf ("Could not write %s: %s\n", path, strerror(errno));
+        success = false;
+    }
+    munmap (map, size);
+    close (file);
+    free (path);
+    return success;
+}
+
+void arranged_db_build_all (int num_threads)
+{
+    int n;
+    for (n=3; n<11; n++) {
+        arranged_db_build (n, num_threads);
+    }
+}
+
+// Opens the arranged layouts of order types of size _n_. Returns false if the
+// file doesn't exist or is invalid, _adb_ is left closed in that case.
+bool arranged_db_open (arranged_db_t *adb, int n)
+{
+    arranged_db_close (adb);
+
+    char *path = arranged_db_path (n);
+    adb->fd = open (path, O_RDONLY);
+    free (path);
+    if (adb->fd == -1) {
+        adb->fd = 0;
+        return false;
+    }
+
+    struct stat st;
+    uint64_t num_order_types = db_num_order_types (n);
+    uint64_t valid_size = arranged_db_valid_size (num_order_types);
+    uint64_t size = sizeof(struct arranged_db_header_t) + valid_size +
+        num_order_types*2*n*sizeof(uint16_t);
+    if (fstat (adb->fd, &st) == -1 || st.st_size != size) {
+        arranged_db_close (adb);
+        return false;
+    }
+
+    void *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, adb->fd, 0);
+    if (map == MAP_FAILED) {
+        arranged_db_close (adb);
+        return false;
+    }
+    adb->map = map;
+    adb->map_size = size;
+
+    struct arranged_db_header_t *header = (struct arranged_db_header_t*)adb->map;
+    if (header->magic != ARRANGED_DB_MAGIC || header->n != n ||
+        header->num_order_types != num_order_types) {
+        arranged_db_close (adb);
+        return false;
+    }
+
+    adb->n = n;
+    adb->num_order_types = num_order_types;
+    adb->valid = adb->map + sizeof(struct arranged_db_header_t);
+    adb->coords = (uint16_t*)(adb->valid + valid_size);
+    return true;
+}
+
+void arranged_db_close (arranged_db_t *adb)
+{
+    if (adb->map != NULL) {
+        munmap (adb->map, adb->map_size);
+    }
+    if (adb->fd > 0) {
+        close (adb->fd);
+    }
+    *adb = (arranged_db_t){0};
+}
+
+// Copies the arranged layout of order type _id_ into _points_. Returns false
+// if the arrangement algorithm didn't find a valid one.
+bool arranged_db_get (arranged_db_t *adb, uint64_t id, dvec2 *points)
+{
+    if (adb->map == NULL || id >= adb->num_order_types ||
+        !(adb->valid[id/8] & (1 << (id%8)))) {
+        return false;
+    }
+
+    uint16_t *coords = adb->coords + id*2*adb->n;
+    int i;
+    for (i=0; i<adb->n; i++) {
+        points[i] = DVEC2 (coords[2*i], coords[2*i+1]);
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2017 Santiago León O. <santileortiz@gmail.com>
+ */
+
+#if !defined(ARRANGE_POINTS_H)
+enum arrange_points_mode_t {
+    ARRANGE_POINTS_FIXED,   // Fixed step size
+    ARRANGE_POINTS_ADAPTIVE // Adaptive step size, see arrange_points_step_adaptive()
+};
+
+struct arrange_points_state_t {
+    enum arrange_points_mode_t mode;
+    mem_pool_t pool;
+    order_type_t *ot;
+    int *sort;
+    int cvx_hull_len;
+    int *cvx_hull;
+    dvec2 centroid;
+    dvec2 *tgt_hull;
+    double tgt_radius;
+    uint64_t steps;
+    orientation_validator_t validator;
+
+    // Only used by ARRANGE_POINTS_ADAPTIVE
+    dvec2 *force; // Forces on the current points
+    dvec2 *validated; // Points whose orientations are in validator
+    double change; // Change indicator of the current points
+    double dt;
+    uint64_t rollbacks;
+};
+
+// Handle to the file with the precomputed arrangement of all order types of
+// size n, see arranged_db_build().
+typedef struct {
+    int n;
+    int fd;
+    uint8_t *map;
+    uint64_t map_size;
+    uint64_t num_order_types;
+    uint8_t *valid; // Bitmap with one bit per order type
+    uint16_t *coords; // 2*n coordinates per order type
+} arranged_db_t;
+
+bool arranged_db_build (int n, int num_threads);
+bool arranged_db_open (arranged_db_t *adb, int n);
+void arranged_db_close (arranged_db_t *adb);
+bool arranged_db_get (arranged_db_t *adb, uint64_t id, dvec2 *points);
+
+#define ARRANGE_POINTS_H
+#endif
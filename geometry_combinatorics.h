@@ -7,6 +7,7 @@
 #include <math.h>
 #include <time.h>
 #include <string.h>
+#include <pthread.h>
 #include "sequence_store.h"
 
 typedef struct {
@@ -104,6 +105,21 @@ int segments_intersect  (ivec2 s1p1, ivec2 s1p2, ivec2 s2p1, ivec2 s2p2)
         (!left_i (s2p1, s2p2, s1p1) ^ !left_i (s2p1, s2p2, s1p2));
 }
 
+// Orientation kernels for i32vec2 points. Coordinate differences are
+// computed in 32 bits, only the products are widened to 64 bits.
+static inline
+int64_t area_2_c (i32vec2 a, i32vec2 b, i32vec2 c)
+{
+    return (int64_t)(b.x-a.x)*(c.y-a.y) -
+           (int64_t)(c.x-a.x)*(b.y-a.y);
+}
+
+static inline
+bool left_c (i32vec2 a, i32vec2 b, i32vec2 c)
+{
+    return area_2_c (a, b, c) > 0;
+}
+
 // Returns true if the segment ap is between the cone spanned clockwise between
 // a0, a, and a1, where a is the apex.
 // NOTE: borders of the cone are defined as being inside the cone up to some
@@ -505,7 +521,10 @@ void sort_all_points_p (order_type_t *ot, int p, int s, int *res)
             res[i] = i;
         }
 
-        res[p] = i;
+        // NOTE: If p is the last point it's already excluded.
+        if (p < ot->n-1) {
+            res[p] = i;
+        }
         struct angle_compare_info_t info = {ot, p, s};
         radial_sort_ot_user_data (res, ot->n-1, &info);
         assert (res[0] == s);
@@ -1370,6 +1389,270 @@ int *get_all_triangles_array (int n, mem_pool_t *pool, int *triangle_order)
     return res;
 }
 
+// Fixed size bitsets of triangles, used as candidate sets by the thrackle
+// search engines.
+#define TRIANGLE_SET_WORDS 3 // binomial(11,3) = 165 triangles
+typedef struct {
+    uint64_t w[TRIANGLE_SET_WORDS];
+} tr_bitset_t;
+
+static inline
+void tr_bitset_fill (tr_bitset_t *b, int num_bits)
+{
+    assert (num_bits <= 64*TRIANGLE_SET_WORDS);
+    int i;
+    for (i=0; i<TRIANGLE_SET_WORDS; i++) {
+        if (num_bits >= 64*(i+1)) {
+            b->w[i] = UINT64_MAX;
+        } else if (num_bits > 64*i) {
+            b->w[i] = (UINT64_C(1) << (num_bits-64*i)) - 1;
+        } else {
+            b->w[i] = 0;
+        }
+    }
+}
+
+static inline
+void tr_bitset_set (tr_bitset_t *b, int i)
+{
+    b->w[i/64] |= UINT64_C(1) << (i%64);
+}
+
+static inline
+void tr_bitset_clear (tr_bitset_t *b, int i)
+{
+    b->w[i/64] &= ~(UINT64_C(1) << (i%64));
+}
+
+static inline
+bool tr_bitset_is_set (tr_bitset_t *b, int i)
+{
+    return (b->w[i/64] >> (i%64)) & 1;
+}
+
+// res = a & b restricted to bits greater than i.
+static inline
+void tr_bitset_and_after (tr_bitset_t *res, tr_bitset_t *a, tr_bitset_t *b, int i)
+{
+    int w = i/64;
+    int j;
+    for (j=0; j<w; j++) {
+        res->w[j] = 0;
+    }
+
+    uint64_t mask = (i%64 == 63) ? 0 : UINT64_MAX << (i%64+1);
+    res->w[w] = a->w[w] & b->w[w] & mask;
+
+    for (j=w+1; j<TRIANGLE_SET_WORDS; j++) {
+        res->w[j] = a->w[j] & b->w[j];
+    }
+}
+
+// Returns the first bit set in _b_ that is greater or equal than _i_, or -1 if
+// there is none.
+static inline
+int tr_bitset_next (tr_bitset_t *b, int i)
+{
+    if (i >= 64*TRIANGLE_SET_WORDS) {
+        return -1;
+    }
+
+    int w = i/64;
+    uint64_t word = b->w[w] & (UINT64_MAX << (i%64));
+    while (1) {
+        if (word != 0) {
+            return 64*w + __builtin_ctzll (word);
+        }
+
+        w++;
+        if (w == TRIANGLE_SET_WORDS) {
+            return -1;
+        }
+        word = b->w[w];
+    }
+}
+
+static inline
+int tr_bitset_count (tr_bitset_t *b)
+{
+    int i, res = 0;
+    for (i=0; i<TRIANGLE_SET_WORDS; i++) {
+        res += __builtin_popcountll (b->w[i]);
+    }
+    return res;
+}
+
+// Compatibility matrix of triangles for a fixed order type
+//
+// Bit j of rows[i] is set if the triangles with lexicographic ids i and j can
+// be in the same thrackle: they share exactly one vertex, or they don't share
+// vertices and an edge of one crosses an edge of the other. It's derived from
+// the orientation table of the order type, crossings between all segments are
+// precomputed as bit masks so each pair of triangles is tested with a few
+// bitwise operations.
+typedef struct {
+    int n;
+    int total_triangles;
+    tr_bitset_t rows[64*TRIANGLE_SET_WORDS];
+} thrackle_compat_t;
+
+void thrackle_compat_from_ot (order_type_t *ot, thrackle_compat_t *compat)
+{
+    int n = ot->n;
+    int total_triangles = binomial (n,3);
+    assert (total_triangles <= 64*TRIANGLE_SET_WORDS);
+    compat->n = n;
+    compat->total_triangles = total_triangles;
+
+    i32vec2 c_pts[n];
+    compact_pts_from_ot (ot, c_pts);
+
+    // NOTE: orient[a][b][c] is true if c is left of ab, only computed for
+    // a<b<c, the rest are obtained from the parity of the permutation.
+    bool orient[n][n][n];
+    int a, b, c;
+    for (a=0; a<n; a++) {
+        for (b=a+1; b<n; b++) {
+            for (c=b+1; c<n; c++) {
+                bool o = left_c (c_pts[a], c_pts[b], c_pts[c]);
+                orient[a][b][c] = o;
+                orient[b][c][a] = o;
+                orient[c][a][b] = o;
+                orient[b][a][c] = !o;
+                orient[a][c][b] = !o;
+                orient[c][b][a] = !o;
+            }
+        }
+    }
+
+    // Segments are numbered lexicographically, there are at most
+    // binomial(11,2) = 55 so a set of segments fits in an uint64_t.
+    int num_segments = n*(n-1)/2;
+    int seg_id[n][n];
+    int seg_pts[num_segments][2];
+    int s = 0;
+    for (a=0; a<n; a++) {
+        for (b=a+1; b<n; b++) {
+            seg_id[a][b] = seg_id[b][a] = s;
+            seg_pts[s][0] = a;
+            seg_pts[s][1] = b;
+            s++;
+        }
+    }
+
+    uint64_t crossings[num_segments];
+    for (s=0; s<num_segments; s++) {
+        crossings[s] = 0;
+    }
+
+    int s1, s2;
+    for (s1=0; s1<num_segments; s1++) {
+        int p = seg_pts[s1][0], q = seg_pts[s1][1];
+        for (s2=s1+1; s2<num_segments; s2++) {
+            int r = seg_pts[s2][0], t = seg_pts[s2][1];
+            if (r == p || r == q || t == p || t == q) {
+                continue;
+            }
+
+            if (orient[p][q][r] != orient[p][q][t] && orient[r][t][p] != orient[r][t][q]) {
+                crossings[s1] |= UINT64_C(1) << s2;
+                crossings[s2] |= UINT64_C(1) << s1;
+            }
+        }
+    }
+
+    mem_pool_t temp_pool = {0};
+    int *all_triangles = get_all_triangles_array (n, &temp_pool, NULL);
+
+    uint64_t vertices[total_triangles];
+    uint64_t edges[total_triangles];
+    uint64_t edge_crossings[total_triangles];
+    int i;
+    for (i=0; i<total_triangles; i++) {
+        int *tr = all_triangles + 3*i;
+        vertices[i] = (UINT64_C(1) << tr[0]) | (UINT64_C(1) << tr[1]) | (UINT64_C(1) << tr[2]);
+
+        int e1 = seg_id[tr[0]][tr[1]], e2 = seg_id[tr[1]][tr[2]], e3 = seg_id[tr[2]][tr[0]];
+        edges[i] = (UINT64_C(1) << e1) | (UINT64_C(1) << e2) | (UINT64_C(1) << e3);
+        edge_crossings[i] = crossings[e1] | crossings[e2] | crossings[e3];
+    }
+
+    for (i=0; i<total_triangles; i++) {
+        // NOTE: This loop has no branches so it can be vectorized by the
+        // compiler.
+        uint8_t is_compatible[64*TRIANGLE_SET_WORDS] = {0};
+        int j;
+        for (j=0; j<total_triangles; j++) {
+            uint64_t common = vertices[i] & vertices[j];
+            uint8_t one_common = common != 0 && (common & (common-1)) == 0;
+            uint8_t crossing = common == 0 && (edge_crossings[i] & edges[j]) != 0;
+            is_compatible[j] = one_common | crossing;
+        }
+
+        int w;
+        for (w=0; w<TRIANGLE_SET_WORDS; w++) {
+            uint64_t word = 0;
+            for (j=0; j<64; j++) {
+                word |= (uint64_t)is_compatible[64*w+j] << j;
+            }
+            compat->rows[i].w[w] = word;
+        }
+    }
+
+    mem_pool_destroy (&temp_pool);
+}
+
+static inline
+bool thrackle_compat_get (thrackle_compat_t *compat, int i, int j)
+{
+    return tr_bitset_is_set (&compat->rows[i], j);
+}
+
+// Computes the rows of the compatibility matrix for the triangles in the
+// order used by get_all_triangles_array() with _triangle_order_. _rows_ must
+// have binomial(n,3) elements.
+void thrackle_compat_rows (thrackle_compat_t *compat, int *triangle_order, tr_bitset_t *rows)
+{
+    int i, j;
+    for (i=0; i<compat->total_triangles; i++) {
+        if (triangle_order == NULL) {
+            rows[i] = compat->rows[i];
+        } else {
+            rows[i] = (tr_bitset_t){0};
+            tr_bitset_t *lex_row = &compat->rows[triangle_order[i]];
+            for (j=0; j<compat->total_triangles; j++) {
+                if (tr_bitset_is_set (lex_row, triangle_order[j])) {
+                    tr_bitset_set (&rows[i], j);
+                }
+            }
+        }
+    }
+}
+
+// Same as is_thrackle() but for a set of _k_ lexicographic triangle ids.
+bool is_thrackle_ids (thrackle_compat_t *compat, int *triangles, int k)
+{
+    int i,j;
+    for (i=0; i<k; i++) {
+        for (j=i+1; j<k; j++) {
+            if (!thrackle_compat_get (compat, triangles[i], triangles[j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Computes the compatibility rows used by the thrackle search engines.
+tr_bitset_t* thrackle_compat_rows_new (order_type_t *ot, int *triangle_order, mem_pool_t *pool)
+{
+    thrackle_compat_t compat;
+    thrackle_compat_from_ot (ot, &compat);
+    tr_bitset_t *rows = mem_pool_push_array (pool, compat.total_triangles, tr_bitset_t);
+    thrackle_compat_rows (&compat, triangle_order, rows);
+    return rows;
+}
+
 // This is for demonstration purposes only, shows what happens when we don't
 // enforce the condition of sequences being in ascending order.
 void thrackle_search_slow (int n, order_type_t *ot, struct sequence_store_t *seq,
@@ -1400,7 +1683,7 @@ void thrackle_search_slow (int n, order_type_t *ot, struct sequence_store_t *seq
     }
 
     mem_pool_t temp_pool = {0};
-    int *all_triangles = get_all_triangles_array (n, &temp_pool, triangle_order);
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, triangle_order, &temp_pool);
 
     seq_tree_extents (seq, total_triangles, k);
     seq_push_element (seq, LEX_TRIANG_ID(triangle_order,0), 0);
@@ -1417,17 +1700,13 @@ void thrackle_search_slow (int n, order_type_t *ot, struct sequence_store_t *seq
         }
         // Compute S
         if (t != NULL) {
-            int *triangle = all_triangles + 3*lb_idx (S, t);
-            triangle_t choosen_tr = TRIANGLE_IDXS (ot, triangle);
+            tr_bitset_t *compatible = &compat[lb_idx (S, t)];
 
             struct linked_bool *S_prev = NULL;
             struct linked_bool *S_curr = S_start;
             while (S_curr != NULL) {
                 int i = lb_idx (S, S_curr);
-                int *candidate_tr_ids = all_triangles + 3*i;
-                int test = count_common_vertices_int (triangle, candidate_tr_ids);
-                if (test == 2) {
-                    // NOTE: Triangles share an edge or are the same.
+                if (!tr_bitset_is_set (compatible, i)) {
                     invalid_triangles[num_invalid++] = i;
 
                     if (S_prev == NULL) {
@@ -1437,21 +1716,6 @@ void thrackle_search_slow (int n, order_type_t *ot, struct sequence_store_t *seq
                     }
                     S_curr = S_curr->next;
                     continue;
-                } else if (test == 0) {
-                    // NOTE: Triangles have no comon vertices, check if
-                    // edges intersect.
-                    triangle_t candidate_tr = TRIANGLE_IDXS (ot, candidate_tr_ids);
-                    if (!have_intersecting_segments (&choosen_tr, &candidate_tr)) {
-                        invalid_triangles[num_invalid++] = i;
-
-                        if (S_prev == NULL) {
-                            S_start = S_curr->next;
-                        } else {
-                            S_prev->next = S_curr->next;
-                        }
-                        S_curr = S_curr->next;
-                        continue;
-                    }
                 }
                 S_prev = S_curr;
                 S_curr = S_curr->next;
@@ -1534,7 +1798,7 @@ bool single_thrackle (int n, int k, order_type_t *ot, int *res, int *count,
     int num_invalid = 0;
 
     mem_pool_t temp_pool = {0};
-    int *all_triangles = get_all_triangles_array (n, &temp_pool, triangle_order);
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, triangle_order, &temp_pool);
 
     *count = 0;
     res[0] = 0;
@@ -1554,39 +1818,24 @@ bool single_thrackle (int n, int k, order_type_t *ot, int *res, int *count,
                 int_sort (res, k);
             }
 
+            mem_pool_destroy (&temp_pool);
             return true;
         } else {
             // Compute S
-            int *triangle = all_triangles + 3*lb_idx (S, t);
-            triangle_t choosen_tr = TRIANGLE_IDXS (ot, triangle);
-
             if (t != NULL) {
+                tr_bitset_t *compatible = &compat[lb_idx (S, t)];
+
                 // NOTE: S_curr=t->next enforces res[] to be an ordered sequence.
                 struct linked_bool *S_prev = t;
                 struct linked_bool *S_curr = t->next;
                 while (S_curr != NULL) {
                     int i = lb_idx (S, S_curr);
-                    int *candidate_tr_ids = all_triangles + 3*i;
-
-                    int test = count_common_vertices_int (triangle, candidate_tr_ids);
-                    if (test == 2) {
-                        // NOTE: Triangles share an edge or are the same.
+                    if (!tr_bitset_is_set (compatible, i)) {
                         invalid_triangles[num_invalid++] = i;
                         S_prev->next = S_curr->next;
 
                         S_curr = S_prev->next;
                         continue;
-                    } else if (test == 0) {
-                        // NOTE: Triangles have no comon vertices, check if
-                        // edges intersect.
-                        triangle_t candidate_tr = TRIANGLE_IDXS (ot, candidate_tr_ids);
-                        if (!have_intersecting_segments (&choosen_tr, &candidate_tr)) {
-                            invalid_triangles[num_invalid++] = i;
-                            S_prev->next = S_curr->next;
-
-                            S_curr = S_prev->next;
-                            continue;
-                        }
                     }
                     S_prev = S_curr;
                     S_curr = S_curr->next;
@@ -1639,6 +1888,7 @@ bool single_thrackle (int n, int k, order_type_t *ot, int *res, int *count,
             }
         }
     }
+    mem_pool_destroy (&temp_pool);
     return false;
 }
 
@@ -1651,9 +1901,9 @@ void all_thrackles (int n, int k, order_type_t *ot, struct sequence_store_t *seq
     assert (n==ot->n);
     int l = 1; // Tree level
 
-    subset_it_t *triangle_it = subset_it_new (n, 3, NULL);
-    subset_it_precompute (triangle_it);
-    int total_triangles = triangle_it->size;
+    thrackle_compat_t compat;
+    thrackle_compat_from_ot (ot, &compat);
+    int total_triangles = compat.total_triangles;
 
     struct linked_bool S[total_triangles];
     int i;
@@ -1684,45 +1934,20 @@ void all_thrackles (int n, int k, order_type_t *ot, struct sequence_store_t *seq
             goto backtrack;
         } else {
             // Compute S
-            subset_it_seek (triangle_it, lb_idx (S, t));
-            int triangle[3];
-            triangle[0] = triangle_it->idx[0];
-            triangle[1] = triangle_it->idx[1];
-            triangle[2] = triangle_it->idx[2];
-
-            triangle_t choosen_tr = TRIANGLE_IT (ot, triangle_it);
-
             if (t != NULL) {
+                tr_bitset_t *compatible = &compat.rows[lb_idx (S, t)];
+
                 // NOTE: S_curr=t->next enforces res[] to be an ordered sequence.
                 struct linked_bool *S_prev = t;
                 struct linked_bool *S_curr = t->next;
                 while (S_curr != NULL) {
                     int i = lb_idx (S, S_curr);
-                    subset_it_seek (triangle_it, i);
-                    int candidate_tr_ids[3];
-                    candidate_tr_ids[0] = triangle_it->idx[0];
-                    candidate_tr_ids[1] = triangle_it->idx[1];
-                    candidate_tr_ids[2] = triangle_it->idx[2];
-
-                    int test = count_common_vertices_int (triangle, candidate_tr_ids);
-                    if (test == 2) {
-                        // NOTE: Triangles share an edge or are the same.
+                    if (!tr_bitset_is_set (compatible, i)) {
                         invalid_triangles[num_invalid++] = i;
                         S_prev->next = S_curr->next;
 
                         S_curr = S_prev->next;
                         continue;
-                    } else if (test == 0) {
-                        // NOTE: Triangles have no comon vertices, check if
-                        // edges intersect.
-                        triangle_t candidate_tr = TRIANGLE_IT (ot, triangle_it);
-                        if (!have_intersecting_segments (&choosen_tr, &candidate_tr)) {
-                            invalid_triangles[num_invalid++] = i;
-                            S_prev->next = S_curr->next;
-
-                            S_curr = S_prev->next;
-                            continue;
-                        }
                     }
                     S_prev = S_curr;
                     S_curr = S_curr->next;
@@ -1778,81 +2003,59 @@ backtrack:
     seq_write_file_header (seq, &info);
 }
 
-// TODO: Is this function really necessary? Finish implementing sequence_store_t
-// so seq_push_sequence() builds a tree too, then test if there is actually a
-// signifficant difference between this and all_thrackles().
+// thrackle_search_tree_bitset() visits the same nodes in the same order, it's
+// used instead when building with -DTHRACKLE_SEARCH_BITSET.
+#if defined(THRACKLE_SEARCH_BITSET)
+#define thrackle_search_tree(n,ot,seq) thrackle_search_tree_bitset(n,ot,seq,NULL)
+#else
 #define thrackle_search_tree(n,ot,seq) thrackle_search_tree_full(n,ot,seq,NULL)
-void thrackle_search_tree_full (int n, order_type_t *ot, struct sequence_store_t *seq,
-                                int *triangle_order)
-{
-    assert (n==ot->n);
-    int l = 1; // Tree level
+#endif
 
-    int total_triangles = binomial (n,3);
-    struct linked_bool S[total_triangles];
-    int i;
-    for (i=0; i<total_triangles-1; i++) {
-        S[i].next = &S[i+1];
-    }
-    S[i].next = NULL;
-    struct linked_bool *t = &S[0];
+// Backtracking loop of thrackle_search_tree_full(). _compat_ are the rows
+// returned by thrackle_compat_rows_new() for the same triangle order used to
+// push elements into _seq_. Expects res[0..min_l] to
+// be already chosen, the node for res[min_l] pushed into _seq_, and the list
+// starting at S[res[min_l]] to contain the triangles compatible with
+// res[0..min_l-1]. Nodes are pushed at level l-level_offset, backtracking
+// never changes res[0..min_l-1] and sequences never grow beyond max_l
+// triangles. The search also stops if _stop_ becomes true.
+void thrackle_search_tree_core (int n, tr_bitset_t *compat, int *triangle_order,
+                                struct linked_bool *S, int *res, int min_l, int max_l,
+                                int level_offset, struct sequence_store_t *seq,
+                                volatile bool *stop)
+{
+    int l = min_l+1; // Tree level
+    struct linked_bool *t = &S[res[min_l]];
 
+    int total_triangles = binomial (n,3);
     int invalid_triangles[total_triangles];
     int num_invalid = 0;
 
-    int k;
-    if (n <= 9) {
-        k = thrackle_size (n);
-    } else {
-        k = thrackle_size_upper_bound (n);
-    }
-
-    mem_pool_t temp_pool = {0};
-    int *all_triangles = get_all_triangles_array (n, &temp_pool, triangle_order);
-
-    seq_tree_extents (seq, total_triangles, k);
-    seq_push_element (seq, LEX_TRIANG_ID(triangle_order,0), 0);
-
-    int res[k];
-    res[0] = 0;
-    int invalid_restore_indx[k];
-    invalid_restore_indx[0] = 0;
+    int invalid_restore_indx[max_l];
+    invalid_restore_indx[min_l] = 0;
 
-    seq_timing_begin (seq);
-    while (l > 0) {
-        if (seq_finish (seq)) {
+    while (l > min_l) {
+        if (seq_finish (seq) || (stop != NULL && *stop)) {
             break;
         }
         // Compute S
-        if (t != NULL) {
-            int *triangle = all_triangles + 3*lb_idx(S, t);
-            triangle_t choosen_tr = TRIANGLE_IDXS (ot, triangle);
+        if (t != NULL && l >= max_l) {
+            // NOTE: Sequence can't grow anymore, force backtracking.
+            t = NULL;
+        } else if (t != NULL) {
+            tr_bitset_t *compatible = &compat[lb_idx (S, t)];
 
             // NOTE: S_curr=t->next enforces res[] to be an ordered sequence.
             struct linked_bool *S_prev = t;
             struct linked_bool *S_curr = t->next;
             while (S_curr != NULL) {
                 int i = lb_idx (S, S_curr);
-                int *candidate_tr_ids = all_triangles + i*3;
-                int test = count_common_vertices_int (triangle, candidate_tr_ids);
-                if (test == 2) {
-                    // NOTE: Triangles share an edge or are the same.
+                if (!tr_bitset_is_set (compatible, i)) {
                     invalid_triangles[num_invalid++] = i;
                     S_prev->next = S_curr->next;
 
                     S_curr = S_prev->next;
                     continue;
-                } else if (test == 0) {
-                    // NOTE: Triangles have no comon vertices, check if
-                    // edges intersect.
-                    triangle_t candidate_tr = TRIANGLE_IDXS (ot, candidate_tr_ids);
-                    if (!have_intersecting_segments (&choosen_tr, &candidate_tr)) {
-                        invalid_triangles[num_invalid++] = i;
-                        S_prev->next = S_curr->next;
-
-                        S_curr = S_prev->next;
-                        continue;
-                    }
                 }
                 S_prev = S_curr;
                 S_curr = S_curr->next;
@@ -1865,14 +2068,14 @@ void thrackle_search_tree_full (int n, order_type_t *ot, struct sequence_store_t
             if (t != NULL) {
                 invalid_restore_indx[l] = num_invalid;
                 res[l] = lb_idx(S, t);
-                seq_push_element (seq, LEX_TRIANG_ID(triangle_order, res[l]), l);
+                seq_push_element (seq, LEX_TRIANG_ID(triangle_order, res[l]), l-level_offset);
                 l++;
                 break;
             }
 
             // Backtrack
             l--;
-            if (l>=0) {
+            if (l>=min_l) {
                 t = &S[res[l]];
                 struct linked_bool *S_prev = NULL;
                 struct linked_bool *S_curr = t;
@@ -1904,6 +2107,1427 @@ void thrackle_search_tree_full (int n, order_type_t *ot, struct sequence_store_t
             }
         }
     }
+}
+
+void thrackle_search_tree_full (int n, order_type_t *ot, struct sequence_store_t *seq,
+                                int *triangle_order)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    struct linked_bool S[total_triangles];
+    int i;
+    for (i=0; i<total_triangles-1; i++) {
+        S[i].next = &S[i+1];
+    }
+    S[i].next = NULL;
+
+    int k;
+    if (n <= 9) {
+        k = thrackle_size (n);
+    } else {
+        k = thrackle_size_upper_bound (n);
+    }
+
+    mem_pool_t temp_pool = {0};
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, triangle_order, &temp_pool);
+
+    seq_tree_extents (seq, total_triangles, k);
+    seq_push_element (seq, LEX_TRIANG_ID(triangle_order,0), 0);
+
+    int res[k];
+    res[0] = 0;
+
+    seq_timing_begin (seq);
+    thrackle_search_tree_core (n, compat, triangle_order, S, res, 0, k, 0, seq, NULL);
+    seq_timing_end (seq);
+    mem_pool_destroy (&temp_pool);
+}
+
+// Parallel version of thrackle_search_tree_full()
+//
+// The tree is expanded sequentially up to depth _split_depth_, each node at
+// that depth becomes a task made of the chosen prefix and the list of
+// triangles that can extend it. The list of tasks is split in advance into
+// one contiguous range for each of the _num_threads_ workers. Workers take
+// tasks from the end of their own range, and when it's empty from the start
+// of the ranges of the others. No tasks are created while searching, so the
+// balance depends on having many more tasks than threads.
+//
+// Each task is searched into its own dry run sequence_store_t, the information
+// from all of them is merged into _seq_ at the end, so _seq_ must use
+// SEQ_DRY_RUN. As with thrackle_search_tree_full(), call seq_tree_end() after
+// this.
+//
+// NOTE: Callbacks set in _seq_ are called with a mutex held, but not in the
+// same order as in the sequential version. When the callback's limit of
+// sequences is reached all workers stop, statistics will be incomplete then,
+// as they are in the sequential version.
+struct thrackle_task_t {
+    int len;
+    int *prefix; // Indices into all_triangles
+    int num_cand;
+    int *cand;
+
+    struct thrackle_task_t *next;
+};
+
+struct thrackle_task_range_t {
+    pthread_mutex_t mutex;
+    struct thrackle_task_t **tasks;
+    int start; // Other workers take tasks from here
+    int end; // The owner takes tasks from here
+};
+
+struct thrackle_tree_stats_t {
+    uint64_t num_nodes;
+    uint64_t *nodes_per_len;
+    uint64_t *leaves_per_len;
+    uint64_t num_sequences;
+    uint64_t expected_tree_size;
+    uint32_t final_max_len;
+    uint32_t final_max_children;
+};
+
+struct thrackle_parallel_t {
+    int n;
+    tr_bitset_t *compat;
+    int *triangle_order;
+    int total_triangles;
+    int max_l;
+    int split_depth;
+
+    struct thrackle_task_t *tasks;
+    struct thrackle_task_t *tasks_end;
+    int num_tasks;
+
+    int num_threads;
+    struct thrackle_task_range_t *ranges;
+
+    pthread_mutex_t mutex;
+    struct sequence_store_t *seq;
+    bool use_callback;
+    uint32_t callback_num_sequences;
+    volatile bool stop;
+};
+
+struct thrackle_worker_t {
+    pthread_t thread;
+    int id;
+    struct thrackle_parallel_t *par;
+    mem_pool_t pool;
+    struct thrackle_tree_stats_t stats;
+    struct thrackle_task_t *curr_task;
+};
+
+void thrackle_tree_stats_init (struct thrackle_tree_stats_t *stats, int max_l, mem_pool_t *pool)
+{
+    *stats = (struct thrackle_tree_stats_t){0};
+    stats->nodes_per_len = mem_pool_push_size_full (pool, (max_l+1)*sizeof(uint64_t),
+                                                    POOL_ZERO_INIT, NULL, NULL);
+    stats->leaves_per_len = mem_pool_push_size_full (pool, (max_l+1)*sizeof(uint64_t),
+                                                     POOL_ZERO_INIT, NULL, NULL);
+}
+
+// Counts a sequence found by the search and calls the callback set in
+// par->seq if it's one that should be reported. _values_ are indices into
+// all_triangles.
+void thrackle_parallel_report (struct thrackle_parallel_t *par, int *values, int len)
+{
+    struct sequence_store_t *seq = par->seq;
+    if (seq->callback_sequence_len != 0 && len != seq->callback_sequence_len) {
+        return;
+    }
+
+    pthread_mutex_lock (&par->mutex);
+    if (seq->callback_max_num_sequences == 0 ||
+        par->callback_num_sequences < seq->callback_max_num_sequences) {
+        par->callback_num_sequences++;
+
+        if (seq->callback != NULL) {
+            int lex_values[len];
+            int i;
+            for (i=0; i<len; i++) {
+                lex_values[i] = LEX_TRIANG_ID(par->triangle_order, values[i]);
+            }
+            seq->callback (seq, lex_values, len, seq->closure);
+        }
+
+        if (seq->callback_max_num_sequences != 0 &&
+            par->callback_num_sequences >= seq->callback_max_num_sequences) {
+            par->stop = true;
+        }
+    }
+    pthread_mutex_unlock (&par->mutex);
+}
+
+// Prepends the prefix of the current task to the sequences found by a worker.
+SEQ_CALLBACK(thrackle_worker_callback)
+{
+    struct thrackle_worker_t *wk = (struct thrackle_worker_t*)closure;
+    struct thrackle_parallel_t *par = wk->par;
+    struct thrackle_task_t *task = wk->curr_task;
+
+    int full_seq[task->len+len];
+    memcpy (full_seq, task->prefix, task->len*sizeof(int));
+    memcpy (full_seq+task->len, seq, len*sizeof(int));
+    thrackle_parallel_report (par, full_seq, task->len+len);
+}
+
+// Expands the node for prefix[len-1]. _cand_ are the triangles after
+// prefix[len-1] compatible with all of prefix[0..len-1].
+void thrackle_split_helper (struct thrackle_parallel_t *par, struct thrackle_tree_stats_t *stats,
+                            mem_pool_t *pool, int *prefix, int len, int *cand, int num_cand)
+{
+    if (par->stop) {
+        return;
+    }
+
+    if (len >= par->max_l) {
+        num_cand = 0;
+    }
+
+    stats->num_nodes++;
+    stats->nodes_per_len[len]++;
+    stats->final_max_len = MAX (stats->final_max_len, len);
+    stats->final_max_children = MAX (stats->final_max_children, num_cand);
+    stats->expected_tree_size += backtrack_node_size (num_cand);
+
+    if (num_cand == 0) {
+        stats->num_sequences++;
+        stats->leaves_per_len[len]++;
+        thrackle_parallel_report (par, prefix, len);
+
+    } else if (len == par->split_depth) {
+        struct thrackle_task_t *task = mem_pool_push_size (pool, sizeof(struct thrackle_task_t));
+        *task = (struct thrackle_task_t){0};
+        task->len = len;
+        task->prefix = mem_pool_push_array (pool, len, int);
+        memcpy (task->prefix, prefix, len*sizeof(int));
+        task->num_cand = num_cand;
+        task->cand = mem_pool_push_array (pool, num_cand, int);
+        memcpy (task->cand, cand, num_cand*sizeof(int));
+
+        LINKED_LIST_APPEND (par->tasks, task);
+        par->num_tasks++;
+
+    } else {
+        int new_cand[num_cand];
+        int i;
+        for (i=0; i<num_cand; i++) {
+            prefix[len] = cand[i];
+
+            int num_new_cand = 0;
+            int j;
+            for (j=i+1; j<num_cand; j++) {
+                if (tr_bitset_is_set (&par->compat[cand[i]], cand[j])) {
+                    new_cand[num_new_cand++] = cand[j];
+                }
+            }
+            thrackle_split_helper (par, stats, pool, prefix, len+1, new_cand, num_new_cand);
+        }
+    }
+}
+
+struct thrackle_task_t* thrackle_get_task (struct thrackle_worker_t *wk)
+{
+    struct thrackle_parallel_t *par = wk->par;
+    struct thrackle_task_t *task = NULL;
+
+    struct thrackle_task_range_t *own = &par->ranges[wk->id];
+    pthread_mutex_lock (&own->mutex);
+    if (own->end > own->start) {
+        own->end--;
+        task = own->tasks[own->end];
+    }
+    pthread_mutex_unlock (&own->mutex);
+
+    int i;
+    for (i=1; task == NULL && i<par->num_threads; i++) {
+        struct thrackle_task_range_t *other = &par->ranges[(wk->id+i)%par->num_threads];
+        pthread_mutex_lock (&other->mutex);
+        if (other->end > other->start) {
+            task = other->tasks[other->start];
+            other->start++;
+        }
+        pthread_mutex_unlock (&other->mutex);
+    }
+
+    return task;
+}
+
+void* thrackle_search_worker (void *arg)
+{
+    struct thrackle_worker_t *wk = (struct thrackle_worker_t*)arg;
+    struct thrackle_parallel_t *par = wk->par;
+    struct thrackle_tree_stats_t *stats = &wk->stats;
+
+    struct linked_bool S[par->total_triangles];
+    int res[par->max_l];
+
+    struct thrackle_task_t *task;
+    while (!par->stop && (task = thrackle_get_task (wk)) != NULL) {
+        wk->curr_task = task;
+        memcpy (res, task->prefix, task->len*sizeof(int));
+        res[task->len] = task->cand[0];
+
+        int i;
+        for (i=0; i<task->num_cand-1; i++) {
+            S[task->cand[i]].next = &S[task->cand[i+1]];
+        }
+        S[task->cand[i]].next = NULL;
+
+        // NOTE: The root of the worker's tree stands for prefix[len-1], which
+        // was already accounted for by thrackle_split_helper().
+        mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&wk->pool);
+        struct sequence_store_t task_seq = new_sequence_store_opts (NULL, &wk->pool, SEQ_DRY_RUN);
+        if (par->use_callback) {
+            seq_set_callback (&task_seq, thrackle_worker_callback, wk);
+        }
+        seq_tree_extents (&task_seq, par->total_triangles, par->max_l-task->len);
+        // NOTE: Workers push indices into all_triangles instead of triangle
+        // ids, thrackle_parallel_report() translates them.
+        seq_push_element (&task_seq, res[task->len], 0);
+        thrackle_search_tree_core (par->n, par->compat, NULL, S, res, task->len, par->max_l, task->len, &task_seq, &par->stop);
+        seq_tree_end (&task_seq);
+
+        stats->num_nodes += task_seq.num_nodes - 1;
+        int j;
+        for (j=1; j<=par->max_l-task->len; j++) {
+            stats->nodes_per_len[j+task->len] += task_seq.nodes_per_len[j];
+            stats->leaves_per_len[j+task->len] += task_seq.leaves_per_len[j];
+        }
+        stats->num_sequences += task_seq.num_sequences;
+        stats->expected_tree_size += task_seq.expected_tree_size - backtrack_node_size (task->num_cand);
+        stats->final_max_len = MAX (stats->final_max_len, task_seq.final_max_len + task->len);
+        stats->final_max_children = MAX (stats->final_max_children, task_seq.final_max_children);
+        mem_pool_end_temporary_memory (mrk);
+    }
+
+    return NULL;
+}
+
+void thrackle_tree_stats_merge (struct thrackle_tree_stats_t *stats, struct thrackle_tree_stats_t *src,
+                                int max_l)
+{
+    stats->num_nodes += src->num_nodes;
+    int i;
+    for (i=0; i<=max_l; i++) {
+        stats->nodes_per_len[i] += src->nodes_per_len[i];
+        stats->leaves_per_len[i] += src->leaves_per_len[i];
+    }
+    stats->num_sequences += src->num_sequences;
+    stats->expected_tree_size += src->expected_tree_size;
+    stats->final_max_len = MAX (stats->final_max_len, src->final_max_len);
+    stats->final_max_children = MAX (stats->final_max_children, src->final_max_children);
+}
+
+// _max_l_ limits the length of the sequences, if it's 0 then the same limit
+// as in thrackle_search_tree_full() is used. If _split_depth_ or _num_threads_
+// are 0, defaults are used.
+#define thrackle_search_tree_parallel(n,ot,seq,num_threads) \
+    thrackle_search_tree_parallel_full(n,ot,seq,NULL,0,0,num_threads)
+void thrackle_search_tree_parallel_full (int n, order_type_t *ot, struct sequence_store_t *seq,
+                                         int *triangle_order, int max_l, int split_depth,
+                                         int num_threads)
+{
+    assert (n==ot->n);
+    assert ((seq->opts & SEQ_DRY_RUN) && "Only dry run stores can be merged.");
+
+    if (max_l <= 0) {
+        if (n <= 9) {
+            max_l = thrackle_size (n);
+        } else {
+            max_l = thrackle_size_upper_bound (n);
+        }
+    }
+
+    if (split_depth <= 0) {
+        split_depth = 2;
+    }
+
+    if (num_threads <= 0) {
+        num_threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+
+    mem_pool_t pool = {0};
+    struct thrackle_parallel_t par = {0};
+    par.n = n;
+    par.total_triangles = binomial (n,3);
+    par.compat = thrackle_compat_rows_new (ot, triangle_order, &pool);
+    par.triangle_order = triangle_order;
+    par.max_l = max_l;
+    par.split_depth = MIN (split_depth, max_l);
+    par.num_threads = num_threads;
+    par.seq = seq;
+    par.use_callback = seq->callback != NULL || seq->callback_max_num_sequences != 0;
+    pthread_mutex_init (&par.mutex, NULL);
+
+    seq_tree_extents (seq, par.total_triangles, max_l);
+    seq_timing_begin (seq);
+
+    struct thrackle_tree_stats_t stats;
+    thrackle_tree_stats_init (&stats, max_l, &pool);
+    // NOTE: seq_tree_extents() already pushed the root.
+    stats.final_max_children = par.total_triangles;
+    stats.expected_tree_size = backtrack_node_size (par.total_triangles);
+
+    {
+        int prefix[max_l];
+        int cand[par.total_triangles];
+        int i;
+        for (i=0; i<par.total_triangles; i++) {
+            prefix[0] = i;
+
+            int num_new_cand = 0;
+            int j;
+            for (j=i+1; j<par.total_triangles; j++) {
+                if (tr_bitset_is_set (&par.compat[i], j)) {
+                    cand[num_new_cand++] = j;
+                }
+            }
+            thrackle_split_helper (&par, &stats, &pool, prefix, 1, cand, num_new_cand);
+        }
+    }
+
+    struct thrackle_task_t **tasks = mem_pool_push_array (&pool, par.num_tasks, struct thrackle_task_t*);
+    {
+        int i = 0;
+        struct thrackle_task_t *task = par.tasks;
+        while (task != NULL) {
+            tasks[i++] = task;
+            task = task->next;
+        }
+    }
+
+    par.ranges = mem_pool_push_array (&pool, num_threads, struct thrackle_task_range_t);
+    struct thrackle_worker_t *workers = mem_pool_push_array (&pool, num_threads, struct thrackle_worker_t);
+    int i;
+    for (i=0; i<num_threads; i++) {
+        struct thrackle_task_range_t *range = &par.ranges[i];
+        pthread_mutex_init (&range->mutex, NULL);
+        range->tasks = tasks;
+        range->start = ((uint64_t)par.num_tasks*i)/num_threads;
+        range->end = ((uint64_t)par.num_tasks*(i+1))/num_threads;
+
+        struct thrackle_worker_t *wk = &workers[i];
+        *wk = (struct thrackle_worker_t){0};
+        wk->id = i;
+        wk->par = &par;
+        thrackle_tree_stats_init (&wk->stats, max_l, &wk->pool);
+    }
+
+    for (i=0; i<num_threads; i++) {
+        pthread_create (&workers[i].thread, NULL, thrackle_search_worker, &workers[i]);
+    }
+
+    for (i=0; i<num_threads; i++) {
+        pthread_join (workers[i].thread, NULL);
+        thrackle_tree_stats_merge (&stats, &workers[i].stats, max_l);
+        mem_pool_destroy (&workers[i].pool);
+    }
+
+    // NOTE: Workers take tasks from any range until all of them are empty, so
+    // no mutex can be destroyed before every worker has finished.
+    for (i=0; i<num_threads; i++) {
+        pthread_mutex_destroy (&par.ranges[i].mutex);
+    }
+
+    seq->num_nodes += stats.num_nodes;
+    if (seq->nodes_per_len != NULL) {
+        for (i=1; i<=max_l; i++) {
+            seq->nodes_per_len[i] += stats.nodes_per_len[i];
+            seq->leaves_per_len[i] += stats.leaves_per_len[i];
+        }
+    }
+    seq->num_sequences += stats.num_sequences;
+    seq->expected_tree_size += stats.expected_tree_size;
+    seq->final_max_len = MAX (seq->final_max_len, stats.final_max_len);
+    seq->final_max_children = MAX (seq->final_max_children, stats.final_max_children);
+
+    if (par.use_callback) {
+        seq->callback_num_sequences = par.callback_num_sequences;
+    } else if (seq->callback_sequence_len == 0) {
+        seq->callback_num_sequences = stats.num_sequences;
+    } else if (seq->callback_sequence_len <= max_l) {
+        seq->callback_num_sequences = stats.leaves_per_len[seq->callback_sequence_len];
+    }
+
+    // NOTE: The tree is complete, this makes seq_tree_end() not count the
+    // root as a leaf.
+    seq->last_l = -2;
+    seq->num_children_count_stack = 0;
+
+    seq_timing_end (seq);
+    pthread_mutex_destroy (&par.mutex);
+    mem_pool_destroy (&pool);
+}
+
+// Stores each sequence as its length followed by its values, so they can be
+// sorted with qsort() and thrackle_sequence_cmp().
+SEQ_CALLBACK(collect_sequence_callback)
+{
+    int_dyn_arr_t *found = (int_dyn_arr_t*)closure;
+    int_dyn_arr_append (found, len);
+    int i;
+    for (i=0; i<len; i++) {
+        int_dyn_arr_append (found, seq[i]);
+    }
+}
+
+int thrackle_sequence_cmp (const void *a, const void *b)
+{
+    const int *s_a = a, *s_b = b;
+    int i;
+    for (i=1; i<=s_a[0]; i++) {
+        if (s_a[i] != s_b[i]) {
+            return s_a[i] < s_b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// Parallel version of all_thrackles(), the search is done by
+// thrackle_search_tree_parallel_full() with _num_threads_ threads, or one per
+// processor if it's 0. Workers find the sequences in any order, they are
+// collected and sorted before pushing them into _seq_, so the result is the
+// same as the one of all_thrackles().
+void all_thrackles_parallel (int n, int k, order_type_t *ot, struct sequence_store_t *seq,
+                             int num_threads)
+{
+    assert (n==ot->n);
+    mem_pool_t pool = {0};
+
+    int_dyn_arr_t found = {0};
+    struct sequence_store_t search = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
+    seq_set_callback (&search, collect_sequence_callback, &found);
+    seq_set_seq_len (&search, k);
+
+    th_file_info_t info;
+    info.n = n;
+
+    seq_allocate_file_header (seq, sizeof(th_file_info_t));
+    seq_set_length (seq, k, 0);
+    seq_timing_begin (seq);
+
+    thrackle_search_tree_parallel_full (n, ot, &search, NULL, k, 0, num_threads);
+    seq_tree_end (&search);
+
+    uint32_t num_found = found.len/(k+1);
+    qsort (found.data, num_found, (k+1)*sizeof(int), thrackle_sequence_cmp);
+    uint32_t i;
+    for (i=0; i<num_found; i++) {
+        seq_push_sequence (seq, found.data + i*(k+1) + 1);
+    }
+
+    seq_timing_end (seq);
+    seq_write_file_header (seq, &info);
+    int_dyn_arr_destroy (&found);
+    mem_pool_destroy (&pool);
+}
+
+// Bitset versions of the thrackle search engines
+//
+// The candidate set for each level is a tr_bitset_t, the candidate set of the
+// next level is computed as S & compat[t] & (bits after t). Backtracking just
+// goes back to the bitset saved for the previous level. The results and the
+// order in which nodes are visited are the same as in the struct linked_bool
+// versions.
+void thrackle_search_tree_bitset (int n, order_type_t *ot, struct sequence_store_t *seq,
+                                  int *triangle_order)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    int k;
+    if (n <= 9) {
+        k = thrackle_size (n);
+    } else {
+        k = thrackle_size_upper_bound (n);
+    }
+
+    mem_pool_t temp_pool = {0};
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, triangle_order, &temp_pool);
+
+    seq_tree_extents (seq, total_triangles, k);
+
+    tr_bitset_t S[k];
+    tr_bitset_fill (&S[0], total_triangles);
+    int res[k];
+    res[0] = -1;
+
+    seq_timing_begin (seq);
+    int l = 0; // Tree level
+    while (l >= 0) {
+        if (seq_finish (seq)) {
+            break;
+        }
+
+        int t = tr_bitset_next (&S[l], res[l]+1);
+        if (t != -1) {
+            // Advance
+            res[l] = t;
+            seq_push_element (seq, LEX_TRIANG_ID(triangle_order, t), l);
+            if (l+1 < k) {
+                tr_bitset_and_after (&S[l+1], &S[l], &compat[t], t);
+                res[l+1] = -1;
+                l++;
+            }
+        } else {
+            // Backtrack
+            l--;
+        }
+    }
+    seq_timing_end (seq);
+    mem_pool_destroy (&temp_pool);
+}
+
+bool single_thrackle_bitset (int n, int k, order_type_t *ot, int *res, int *count,
+                             int *triangle_order)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    mem_pool_t temp_pool = {0};
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, triangle_order, &temp_pool);
+
+    bool found = false;
+    tr_bitset_t S[k];
+    tr_bitset_fill (&S[0], total_triangles);
+    res[0] = -1;
+    *count = 0;
+
+    int l = 0; // Tree level
+    while (l >= 0) {
+        int t = tr_bitset_next (&S[l], res[l]+1);
+        if (t != -1) {
+            // Advance
+            res[l] = t;
+            (*count)++;
+            if (l+1 == k) {
+                found = true;
+                break;
+            }
+            tr_bitset_and_after (&S[l+1], &S[l], &compat[t], t);
+            res[l+1] = -1;
+            l++;
+        } else {
+            // Backtrack
+            l--;
+        }
+    }
+
+    if (found) {
+        // Convert resulting thrackle to lexicographic ids of triangles, not
+        // position in all_triangles array.
+        int i;
+        for (i=0; i<k; i++) {
+            res[i] = LEX_TRIANG_ID (triangle_order, res[i]);
+        }
+
+        if (triangle_order) {
+            int_sort (res, k);
+        }
+    }
+
+    mem_pool_destroy (&temp_pool);
+    return found;
+}
+
+void all_thrackles_bitset (int n, int k, order_type_t *ot, struct sequence_store_t *seq)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    mem_pool_t temp_pool = {0};
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, NULL, &temp_pool);
+
+    th_file_info_t info;
+    info.n = n;
+
+    seq_allocate_file_header (seq, sizeof(th_file_info_t));
+    seq_set_length (seq, k, 0);
+    seq_timing_begin (seq);
+
+    tr_bitset_t S[k];
+    tr_bitset_fill (&S[0], total_triangles);
+    int res[k];
+    res[0] = -1;
+
+    int l = 0; // Tree level
+    while (l >= 0) {
+        int t = tr_bitset_next (&S[l], res[l]+1);
+        if (t != -1) {
+            // Advance
+            res[l] = t;
+            if (l+1 == k) {
+                seq_push_sequence (seq, res);
+            } else {
+                tr_bitset_and_after (&S[l+1], &S[l], &compat[t], t);
+                res[l+1] = -1;
+                l++;
+            }
+        } else {
+            // Backtrack
+            l--;
+        }
+    }
+
+    seq_timing_end (seq);
+    seq_write_file_header (seq, &info);
+    mem_pool_destroy (&temp_pool);
+}
+
+// Branch and bound
+//
+// A thrackle is a clique in the graph whose edges are the compatible pairs of
+// triangles, so the candidates left at a node can be colored greedily with
+// classes of pairwise incompatible triangles. At most one triangle of each
+// class can be added, so the node is pruned if the chosen triangles plus the
+// number of colors can't beat the best thrackle found so far. Coloring is
+// skipped when the number of candidates is already small enough to prune.
+
+// Number of colors used by a greedy coloring of _P_ where each class is a set
+// of pairwise incompatible triangles. Stops early and returns _max_colors_ if
+// more colors than that are needed.
+static inline
+int thrackle_color_bound (tr_bitset_t *compat, tr_bitset_t *P, int max_colors)
+{
+    tr_bitset_t uncolored = *P;
+    int colors = 0;
+    int t = tr_bitset_next (&uncolored, 0);
+    while (t != -1) {
+        if (colors == max_colors) {
+            return max_colors;
+        }
+        colors++;
+
+        tr_bitset_t Q = uncolored;
+        while (t != -1) {
+            tr_bitset_clear (&uncolored, t);
+            int i;
+            for (i=0; i<TRIANGLE_SET_WORDS; i++) {
+                Q.w[i] &= ~compat[t].w[i];
+            }
+            t = tr_bitset_next (&Q, t+1);
+        }
+        t = tr_bitset_next (&uncolored, 0);
+    }
+    return colors;
+}
+
+// Looks for the largest thrackle of _ot_ that has at least _min_size_
+// triangles, and stops as soon as one with _stop_size_ triangles is found.
+// The thrackle is stored in _res_, which must have room for
+// thrackle_size_upper_bound(n) elements, and its size is returned, or 0 if
+// there is none of size at least min_size. Like in thrackle_search_tree() the
+// search never goes deeper than thrackle_size(n) for n<=9, which is the
+// maximum over all order types. If _num_nodes_ is not NULL it's set
+// to the number of nodes visited.
+//
+// NOTE: Use max_thrackle_bnb() to get the maximum size and thrackle_exists() to
+// decide if there is a thrackle of some size. The latter starts with a lower
+// bound of k-1 so it prunes much more than a maximum search.
+int thrackle_branch_and_bound (int n, order_type_t *ot, int min_size, int stop_size,
+                               int *res, uint64_t *num_nodes)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    int k;
+    if (n <= 9) {
+        k = thrackle_size (n);
+    } else {
+        k = thrackle_size_upper_bound (n);
+    }
+    stop_size = MIN (stop_size, k);
+    mem_pool_t temp_pool = {0};
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, NULL, &temp_pool);
+
+    int best = MAX (min_size-1, 0);
+    int best_found = 0;
+    uint64_t nodes = 0;
+
+    tr_bitset_t S[k+1];
+    tr_bitset_fill (&S[0], total_triangles);
+    int curr[k];
+    curr[0] = -1;
+
+    int l = 0; // Tree level
+    while (l >= 0) {
+        int t = tr_bitset_next (&S[l], curr[l]+1);
+        if (t != -1) {
+            // Advance
+            curr[l] = t;
+            nodes++;
+
+            if (l+1 > best) {
+                best = best_found = l+1;
+                memcpy (res, curr, best*sizeof(int));
+                if (best_found == stop_size) {
+                    break;
+                }
+            }
+
+            if (l+1 < k) {
+                tr_bitset_and_after (&S[l+1], &S[l], &compat[t], t);
+                int needed = best - l; // Candidates needed to beat best
+                if (tr_bitset_count (&S[l+1]) >= needed &&
+                    thrackle_color_bound (compat, &S[l+1], needed) >= needed) {
+                    curr[l+1] = -1;
+                    l++;
+                }
+            }
+        } else {
+            // Backtrack
+            l--;
+        }
+    }
+
+    if (num_nodes != NULL) {
+        *num_nodes = nodes;
+    }
+    mem_pool_destroy (&temp_pool);
+    return best_found;
+}
+
+#define max_thrackle_bnb(n,ot,res,num_nodes) \
+    thrackle_branch_and_bound(n,ot,1,thrackle_size_upper_bound(n),res,num_nodes)
+#define thrackle_exists(n,ot,k,res,num_nodes) \
+    (thrackle_branch_and_bound(n,ot,k,k,res,num_nodes) >= (k))
+
+// Maximum clique
+//
+// Bit parallel maximum clique solver on the compatibility graph, following
+// BBMC by San Segundo et al. Triangles are relabeled by non increasing
+// degree, then at each node the candidates are colored greedily with
+// independent sets in that order. Only candidates with a color that could
+// still beat the best clique are kept, and they are expanded from the highest
+// color down. Once the color of the next candidate plus the size of the
+// current clique can't beat the best one, the rest of the node is pruned,
+// because candidates are sorted by color.
+//
+// Unlike thrackle_branch_and_bound() the branching order is the coloring
+// order, so the color bound of every candidate comes for free, but the whole
+// candidate set is colored at each node.
+
+// Colors _P_ and stores in _order_ and _color_ the candidates with color at
+// least _min_color_, sorted by color. Returns the number of stored candidates.
+static inline
+int max_clique_color_sort (tr_bitset_t *adj, tr_bitset_t *P, int min_color, int *order, int *color)
+{
+    tr_bitset_t uncolored = *P;
+    int cnt = 0;
+    int k = 1;
+    int v = tr_bitset_next (&uncolored, 0);
+    while (v != -1) {
+        tr_bitset_t Q = uncolored;
+        while (v != -1) {
+            tr_bitset_clear (&uncolored, v);
+            if (k >= min_color) {
+                order[cnt] = v;
+                color[cnt] = k;
+                cnt++;
+            }
+
+            int i;
+            for (i=0; i<TRIANGLE_SET_WORDS; i++) {
+                Q.w[i] &= ~adj[v].w[i];
+            }
+            v = tr_bitset_next (&Q, v+1);
+        }
+        k++;
+        v = tr_bitset_next (&uncolored, 0);
+    }
+    return cnt;
+}
+
+// Stores a maximum thrackle of _ot_ in _res_ sorted by lexicographic id, and
+// returns its size. _res_ must have room for thrackle_size_upper_bound(n)
+// elements. If _all_ is not NULL, all maximum thrackles are pushed to it. If
+// _num_nodes_ is not NULL it's set to the number of nodes visited.
+int thrackle_max_clique (int n, order_type_t *ot, int *res, struct sequence_store_t *all,
+                         uint64_t *num_nodes)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    mem_pool_t temp_pool = {0};
+
+    thrackle_compat_t compat;
+    thrackle_compat_from_ot (ot, &compat);
+
+    // NOTE: Vertex i of the relabeled graph is triangle triangle_order[i].
+    int_key_t keys[total_triangles];
+    int i;
+    for (i=0; i<total_triangles; i++) {
+        keys[i].key = total_triangles - tr_bitset_count (&compat.rows[i]);
+        keys[i].origin = i;
+    }
+    sort_int_keys (keys, total_triangles);
+    int triangle_order[total_triangles];
+    for (i=0; i<total_triangles; i++) {
+        triangle_order[i] = keys[i].origin;
+    }
+    tr_bitset_t *adj = mem_pool_push_array (&temp_pool, total_triangles, tr_bitset_t);
+    thrackle_compat_rows (&compat, triangle_order, adj);
+
+    int max_l = thrackle_size_upper_bound (n) + 1;
+    tr_bitset_t P[max_l];
+    int *order = mem_pool_push_array (&temp_pool, max_l*total_triangles, int);
+    int *color = mem_pool_push_array (&temp_pool, max_l*total_triangles, int);
+    int next[max_l]; // Position in order[] of the next candidate to expand
+    int clique[max_l];
+
+    // NOTE: When looking for all maximum cliques, candidates that can only
+    // reach the size of the best one are expanded too.
+    int tie = all != NULL ? 1 : 0;
+    int best = 0;
+    int_dyn_arr_t found = {0};
+    uint64_t nodes = 0;
+
+    tr_bitset_fill (&P[0], total_triangles);
+    next[0] = max_clique_color_sort (adj, &P[0], 1, order, color) - 1;
+
+    int l = 0; // Tree level, also size of the current clique
+    while (l >= 0) {
+        int *l_order = &order[l*total_triangles];
+        int *l_color = &color[l*total_triangles];
+        if (next[l] < 0 || l + l_color[next[l]] + tie <= best) {
+            // Backtrack
+            l--;
+            if (l >= 0) {
+                tr_bitset_clear (&P[l], clique[l]);
+                next[l]--;
+            }
+            continue;
+        }
+
+        // Advance
+        int v = l_order[next[l]];
+        clique[l] = v;
+        nodes++;
+
+        int j;
+        for (j=0; j<TRIANGLE_SET_WORDS; j++) {
+            P[l+1].w[j] = P[l].w[j] & adj[v].w[j];
+        }
+
+        if (tr_bitset_next (&P[l+1], 0) == -1) {
+            if (l+1 > best) {
+                best = l+1;
+                found.len = 0;
+                for (j=0; j<best; j++) {
+                    res[j] = triangle_order[clique[j]];
+                }
+                int_sort (res, best);
+            }
+
+            if (all != NULL && l+1 == best) {
+                for (j=0; j<best; j++) {
+                    int_dyn_arr_append (&found, triangle_order[clique[j]]);
+                }
+                int_sort (&found.data[found.len-best], best);
+            }
+
+            tr_bitset_clear (&P[l], v);
+            next[l]--;
+        } else {
+            int min_color = MAX (best - l - tie, 1);
+            next[l+1] = max_clique_color_sort (adj, &P[l+1], min_color,
+                                               &order[(l+1)*total_triangles],
+                                               &color[(l+1)*total_triangles]) - 1;
+            l++;
+        }
+    }
+
+    if (all != NULL) {
+        seq_set_length (all, best, 0);
+        for (i=0; i<found.len; i+=best) {
+            seq_push_sequence (all, &found.data[i]);
+        }
+        int_dyn_arr_destroy (&found);
+    }
+
+    if (num_nodes != NULL) {
+        *num_nodes = nodes;
+    }
+    mem_pool_destroy (&temp_pool);
+    return best;
+}
+
+// Incremental counting
+//
+// Consecutive order types in the database usually differ in the orientation
+// of few triples. A pair of triangles can only change compatibility if one of
+// them has an edge whose endpoints are in a triple with different
+// orientation, so only the rows of those triangles need to be compared.
+// Thrackles of the new compatibility graph are then counted from the ones of
+// the previous graph: removed pairs are deleted one at a time subtracting the
+// thrackles that contain them, and added pairs are inserted one at a time
+// adding the thrackles that contain them. This way each thrackle is counted
+// exactly once, and only the part of the search tree below a changed pair is
+// explored.
+
+// Marks in _closure_, a tr_bitset_t, the triangles that contain two points of
+// the triple with rank _rank_.
+CHIROTOPE_DIFF_CB(mark_affected_triangles)
+{
+    tr_bitset_t *affected = (tr_bitset_t*)closure;
+    int tr[3];
+    triple_unrank (n, rank, &tr[0], &tr[1], &tr[2]);
+
+    int i, p;
+    for (i=0; i<3; i++) {
+        for (p=0; p<n; p++) {
+            if (p != tr[0] && p != tr[1] && p != tr[2]) {
+                int idx[3] = {tr[(i+1)%3], tr[(i+2)%3], p};
+                int_sort (idx, 3);
+                tr_bitset_set (affected, subset_it_id_for_idx (n, idx, 3));
+            }
+        }
+    }
+}
+
+// Sets in _affected_ the triangles whose row in the compatibility matrix may
+// be different for the order types with chirotopes _ch_1_ and _ch_2_. Returns
+// the number of triples with different orientation.
+uint32_t thrackle_compat_affected_rows (chirotope_t *ch_1, chirotope_t *ch_2, tr_bitset_t *affected)
+{
+    *affected = (tr_bitset_t){0};
+    return chirotope_diff (ch_1, ch_2, mark_affected_triangles, affected);
+}
+
+// Adds _sign_ times the number of thrackles of each size up to _k_ that
+// contain triangles _a_ and _b_ to _count_per_len_. _adj_ are rows of a
+// compatibility matrix where _a_ and _b_ are compatible.
+static inline
+void thrackle_count_with_pair (tr_bitset_t *adj, int a, int b, int k, int sign,
+                               uint64_t *count_per_len)
+{
+    if (k < 2) {
+        return;
+    }
+    count_per_len[2] += sign;
+
+    tr_bitset_t S[k];
+    int j;
+    for (j=0; j<TRIANGLE_SET_WORDS; j++) {
+        S[0].w[j] = adj[a].w[j] & adj[b].w[j];
+    }
+    int res[k];
+    res[0] = -1;
+
+    // NOTE: At level l the thrackle has size l+3.
+    int l = 0; // Tree level
+    while (l >= 0) {
+        int t = l+2 < k ? tr_bitset_next (&S[l], res[l]+1) : -1;
+        if (t != -1) {
+            // Advance
+            res[l] = t;
+            count_per_len[l+3] += sign;
+            tr_bitset_and_after (&S[l+1], &S[l], &adj[t], t);
+            res[l+1] = -1;
+            l++;
+        } else {
+            // Backtrack
+            l--;
+        }
+    }
+}
+
+// Updates _count_per_len_, the number of thrackles of each size up to _k_ for
+// the compatibility rows _prev_, so it counts the thrackles for the rows
+// _curr_. Only rows of triangles in _affected_ are compared. Returns the
+// number of pairs of triangles that changed compatibility. If they are more
+// than _max_changed_pairs_ nothing is updated, a full search will be faster.
+//
+// NOTE: Counts are updated in modular arithmetic, so intermediate underflows
+// cancel out.
+int thrackle_count_update (int n, int k, tr_bitset_t *prev, tr_bitset_t *curr,
+                           tr_bitset_t *affected, int max_changed_pairs,
+                           uint64_t *count_per_len)
+{
+    int total_triangles = binomial (n,3);
+    int changed_a[max_changed_pairs+1];
+    int changed_b[max_changed_pairs+1];
+    int num_changed = 0;
+
+    int a = tr_bitset_next (affected, 0);
+    while (a != -1) {
+        tr_bitset_t diff;
+        int j;
+        for (j=0; j<TRIANGLE_SET_WORDS; j++) {
+            diff.w[j] = prev[a].w[j] ^ curr[a].w[j];
+        }
+
+        int b = tr_bitset_next (&diff, 0);
+        while (b != -1) {
+            // NOTE: Pairs with both triangles affected are found twice.
+            if (b > a || !tr_bitset_is_set (affected, b)) {
+                if (num_changed == max_changed_pairs) {
+                    return num_changed+1;
+                }
+                changed_a[num_changed] = a;
+                changed_b[num_changed] = b;
+                num_changed++;
+            }
+            b = tr_bitset_next (&diff, b+1);
+        }
+        a = tr_bitset_next (affected, a+1);
+    }
+
+    if (num_changed == 0) {
+        return 0;
+    }
+
+    tr_bitset_t G[total_triangles];
+    memcpy (G, prev, total_triangles*sizeof(tr_bitset_t));
+
+    int i;
+    for (i=0; i<num_changed; i++) {
+        int t_a = changed_a[i], t_b = changed_b[i];
+        if (!tr_bitset_is_set (&curr[t_a], t_b)) {
+            thrackle_count_with_pair (G, t_a, t_b, k, -1, count_per_len);
+            tr_bitset_clear (&G[t_a], t_b);
+            tr_bitset_clear (&G[t_b], t_a);
+        }
+    }
+
+    for (i=0; i<num_changed; i++) {
+        int t_a = changed_a[i], t_b = changed_b[i];
+        if (tr_bitset_is_set (&curr[t_a], t_b)) {
+            tr_bitset_set (&G[t_a], t_b);
+            tr_bitset_set (&G[t_b], t_a);
+            thrackle_count_with_pair (G, t_a, t_b, k, 1, count_per_len);
+        }
+    }
+
+    return num_changed;
+}
+
+// Symmetry breaking
+//
+// Permutations of the points that preserve the order type also permute its
+// triangles, and map thrackles to thrackles. To enumerate thrackles up to
+// these symmetries only sets that are lexicographically smallest in their
+// orbit are kept. If the image of the smallest l triangles of a set is smaller
+// than them, the image of the full set is smaller too, so the search prunes
+// prefixes that are not canonical.
+//
+// Sorting the image for every permutation at every node costs more than it
+// saves, so inner nodes only use a weaker test: if some triangle of the prefix
+// has an image smaller than the first one, the sorted image of the prefix by
+// that permutation starts with a smaller triangle. The full test is done on
+// the leaves.
+//
+// The size of the orbit of each representative is the order of the group
+// divided by the size of its stabilizer, the labeled count is the sum of these.
+typedef struct {
+    int total_triangles;
+    int num_perms; // The first one is the identity
+    int *perms;    // Image of triangle t by permutation i is perms[i*total_triangles+t]
+    int *orbit_min; // Smallest image of each triangle
+} triangle_group_t;
+
+// Builds the group of triangle permutations induced by the _num_perms_
+// permutations of _n_ points in _point_perms_, each one an array of n
+// elements. The first one must be the identity.
+void triangle_group_from_point_perms (triangle_group_t *grp, int n, int *point_perms, int num_perms,
+                                      mem_pool_t *pool)
+{
+    int total_triangles = binomial (n, 3);
+    grp->total_triangles = total_triangles;
+    grp->num_perms = num_perms;
+    grp->perms = mem_pool_push_array (pool, num_perms*total_triangles, int);
+    grp->orbit_min = mem_pool_push_array (pool, total_triangles, int);
+
+    int i, t;
+    for (t=0; t<total_triangles; t++) {
+        grp->orbit_min[t] = t;
+    }
+    for (i=0; i<num_perms; i++) {
+        int *perm = &point_perms[i*n];
+        for (t=0; t<total_triangles; t++) {
+            int tr[3];
+            subset_it_idx_for_id (t, n, tr, 3);
+            int img[3] = {perm[tr[0]], perm[tr[1]], perm[tr[2]]};
+            int_sort (img, 3);
+            int img_t = subset_it_id_for_idx (n, img, 3);
+            grp->perms[i*total_triangles+t] = img_t;
+            grp->orbit_min[t] = MIN (grp->orbit_min[t], img_t);
+        }
+    }
+}
+
+// Dihedral group of _ot_, which must be in convex position. Rotations and
+// reflections of the convex hull don't change the order type.
+void dihedral_triangle_group (order_type_t *ot, triangle_group_t *grp, mem_pool_t *pool)
+{
+    int n = ot->n;
+
+    // NOTE: In convex position the order of the points around the centroid is
+    // the order along the convex hull.
+    dvec2 centroid = DVEC2 (0, 0);
+    int i;
+    for (i=0; i<n; i++) {
+        centroid.x += (double)ot->pts[i].x/n;
+        centroid.y += (double)ot->pts[i].y/n;
+    }
+    int_key_t keys[n];
+    for (i=0; i<n; i++) {
+        double angle = atan2 (ot->pts[i].y-centroid.y, ot->pts[i].x-centroid.x);
+        keys[i].key = (int)(angle*1e6);
+        keys[i].origin = i;
+    }
+    sort_int_keys (keys, n);
+    int hull[n];
+    for (i=0; i<n; i++) {
+        hull[i] = keys[i].origin;
+    }
+    for (i=0; i<n; i++) {
+        assert (left_i (ot->pts[hull[i]], ot->pts[hull[(i+1)%n]], ot->pts[hull[(i+2)%n]]) &&
+                "Order type is not in convex position.");
+    }
+
+    int point_perms[2*n*n];
+    int r;
+    for (r=0; r<n; r++) {
+        int *rot = &point_perms[r*n];
+        int *refl = &point_perms[(n+r)*n];
+        for (i=0; i<n; i++) {
+            rot[hull[i]] = hull[(i+r)%n];
+            refl[hull[i]] = hull[(n-i+r)%n];
+        }
+    }
+    triangle_group_from_point_perms (grp, n, point_perms, 2*n, pool);
+}
+
+// Sorted image of the set of triangles _set_ of size _len_ by permutation _i_
+// of _grp_.
+static inline
+void triangle_set_image (triangle_group_t *grp, int i, int *set, int len, int *res)
+{
+    int *perm = &grp->perms[i*grp->total_triangles];
+    int j;
+    for (j=0; j<len; j++) {
+        int t = perm[set[j]];
+        int m = j;
+        while (m > 0 && res[m-1] > t) {
+            res[m] = res[m-1];
+            m--;
+        }
+        res[m] = t;
+    }
+}
+
+// Returns false if some permutation of _grp_ maps the sorted set _set_ to a
+// lexicographically smaller one.
+bool triangle_set_is_canonical (triangle_group_t *grp, int *set, int len)
+{
+    int img[len];
+    int i, j;
+    for (i=1; i<grp->num_perms; i++) {
+        triangle_set_image (grp, i, set, len, img);
+        for (j=0; j<len && img[j] == set[j]; j++);
+        if (j < len && img[j] < set[j]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Number of different images of the sorted set _set_ under _grp_.
+int triangle_set_orbit_size (triangle_group_t *grp, int *set, int len)
+{
+    int img[len];
+    int i, stabilizer = 0;
+    for (i=0; i<grp->num_perms; i++) {
+        triangle_set_image (grp, i, set, len, img);
+        if (memcmp (img, set, len*sizeof(int)) == 0) {
+            stabilizer++;
+        }
+    }
+    return grp->num_perms/stabilizer;
+}
+
+// Same as all_thrackles_bitset() but only stores one thrackle from each orbit
+// under _grp_, the lexicographically smallest. If _orbit_size_count_ is not
+// NULL, it must have grp->num_perms+1 elements, and orbit_size_count[s] is
+// incremented for each representative with an orbit of size s.
+void all_thrackles_canonical (int n, int k, order_type_t *ot, triangle_group_t *grp,
+                              struct sequence_store_t *seq, uint64_t *orbit_size_count)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    mem_pool_t temp_pool = {0};
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, NULL, &temp_pool);
+
+    th_file_info_t info;
+    info.n = n;
+
+    seq_allocate_file_header (seq, sizeof(th_file_info_t));
+    seq_set_length (seq, k, 0);
+    seq_timing_begin (seq);
+
+    tr_bitset_t S[k];
+    tr_bitset_fill (&S[0], total_triangles);
+    int res[k];
+    res[0] = -1;
+
+    int l = 0; // Tree level
+    while (l >= 0) {
+        int t = tr_bitset_next (&S[l], res[l]+1);
+        if (t != -1) {
+            // Advance
+            res[l] = t;
+            if (grp->orbit_min[t] < res[0]) {
+                continue;
+            }
+
+            if (l+1 == k) {
+                if (!triangle_set_is_canonical (grp, res, k)) {
+                    continue;
+                }
+                seq_push_sequence (seq, res);
+                if (orbit_size_count != NULL) {
+                    orbit_size_count[triangle_set_orbit_size (grp, res, k)]++;
+                }
+            } else {
+                tr_bitset_and_after (&S[l+1], &S[l], &compat[t], t);
+                res[l+1] = -1;
+                l++;
+            }
+        } else {
+            // Backtrack
+            l--;
+        }
+    }
+
+    seq_timing_end (seq);
+    seq_write_file_header (seq, &info);
+    mem_pool_destroy (&temp_pool);
+}
+
+// Automorphism group of _ot_, the permutations of its points that preserve the
+// chirotope up to a reflection. Most order types only have the identity, in
+// that case grp->num_perms is 1 and the searches below don't do any
+// canonicity checks.
+void automorphism_triangle_group (order_type_t *ot, triangle_group_t *grp, mem_pool_t *pool)
+{
+    mem_pool_t temp_pool = {0};
+    int n = ot->n;
+    chirotope_t *ch = chirotope_new (ot, &temp_pool);
+    int *point_perms = mem_pool_push_array (&temp_pool, 2*n*n, int);
+    int num_perms = chirotope_automorphisms (ch, point_perms);
+    triangle_group_from_point_perms (grp, n, point_perms, num_perms, pool);
+    mem_pool_destroy (&temp_pool);
+}
+
+// Returns 0 if the sorted set _set_ is not canonical under _grp_, otherwise
+// returns the size of its orbit. Does the work of triangle_set_is_canonical()
+// and triangle_set_orbit_size() in a single pass over the group.
+int triangle_set_canonical_orbit_size (triangle_group_t *grp, int *set, int len)
+{
+    int img[len];
+    int i, j, stabilizer = 1;
+    for (i=1; i<grp->num_perms; i++) {
+        triangle_set_image (grp, i, set, len, img);
+        for (j=0; j<len && img[j] == set[j]; j++);
+        if (j == len) {
+            stabilizer++;
+        } else if (img[j] < set[j]) {
+            return 0;
+        }
+    }
+    return grp->num_perms/stabilizer;
+}
+
+// Same as thrackle_search_tree_bitset() but leaves of the tree are only stored
+// if they are canonical under _grp_, usually the group computed by
+// automorphism_triangle_group(). Inner nodes are pruned with the cheap test
+// described above, so the number of nodes at the maximum size is the number
+// of thrackles of that size up to symmetry, but at smaller sizes some non
+// canonical thrackles are still counted.
+//
+// If _labeled_per_len_ is not NULL it must have k+1 elements, where k is the
+// height of the tree. labeled_per_len[s] is incremented by the orbit size of
+// each canonical leaf of size s, at the maximum size this is the same count
+// seq->nodes_per_len has in the unpruned search.
+void thrackle_search_tree_canonical (int n, order_type_t *ot, triangle_group_t *grp,
+                                     struct sequence_store_t *seq, uint64_t *labeled_per_len)
+{
+    assert (n==ot->n);
+
+    int total_triangles = binomial (n,3);
+    int k;
+    if (n <= 9) {
+        k = thrackle_size (n);
+    } else {
+        k = thrackle_size_upper_bound (n);
+    }
+
+    mem_pool_t temp_pool = {0};
+    tr_bitset_t *compat = thrackle_compat_rows_new (ot, NULL, &temp_pool);
+
+    seq_tree_extents (seq, total_triangles, k);
+
+    tr_bitset_t S[k];
+    tr_bitset_fill (&S[0], total_triangles);
+    int res[k];
+    res[0] = -1;
+
+    seq_timing_begin (seq);
+    int max_leaf_len = 0;
+    int l = 0; // Tree level
+    while (l >= 0) {
+        if (seq_finish (seq)) {
+            break;
+        }
+
+        int t = tr_bitset_next (&S[l], res[l]+1);
+        if (t != -1) {
+            // Advance
+            res[l] = t;
+            if (grp->orbit_min[t] < res[0]) {
+                continue;
+            }
+
+            bool is_leaf = true;
+            if (l+1 < k) {
+                tr_bitset_and_after (&S[l+1], &S[l], &compat[t], t);
+                is_leaf = tr_bitset_next (&S[l+1], 0) == -1;
+            }
+
+            if (is_leaf && l+1 >= max_leaf_len) {
+                // NOTE: Leaves smaller than one already found can't be of
+                // the maximum size, don't spend time checking them.
+                max_leaf_len = l+1;
+                int orbit_size = 1;
+                if (grp->num_perms > 1) {
+                    orbit_size = triangle_set_canonical_orbit_size (grp, res, l+1);
+                    if (orbit_size == 0) {
+                        continue;
+                    }
+                }
+
+                seq_push_element (seq, t, l);
+                if (labeled_per_len != NULL) {
+                    labeled_per_len[l+1] += orbit_size;
+                }
+            } else if (is_leaf) {
+                seq_push_element (seq, t, l);
+            } else {
+                seq_push_element (seq, t, l);
+                res[l+1] = -1;
+                l++;
+            }
+        } else {
+            // Backtrack
+            l--;
+        }
+    }
     seq_timing_end (seq);
     mem_pool_destroy (&temp_pool);
 }
@@ -30,7 +30,7 @@ uint64_t db_num_order_types (int n)
 
 int db_coord_size (int n)
 {
-    if (n>8 && n<11) {
+    if (n>8 && n<12) {
         return 16;
     } else {
         return 8;
@@ -39,7 +39,196 @@ int db_coord_size (int n)
 
 char* otdb_names [] = { "", "", "",
                        "otypes03.b08", "otypes04.b08", "otypes05.b08", "otypes06.b08",
-                       "otypes07.b08", "otypes08.b08", "otypes09.b16", "otypes10.b16"};
+                       "otypes07.b08", "otypes08.b08", "otypes09.b16", "otypes10.b16",
+                       "otypes11.b16"};
+
+// NOTE: The database for n=11 is ~100GB, it's not part of the "full"
+// database checked and downloaded by check_database(), it has to be placed in
+// the database location by hand.
+char* db_file_path (char *location, int n)
+{
+    char *dir_path = sh_expand (location, NULL);
+    char *full_path = malloc (strlen(dir_path)+strlen(otdb_names[11])+1);
+    char *f_loc = stpcpy (full_path, dir_path);
+    strcpy (f_loc, otdb_names[n]);
+    free (dir_path);
+    return full_path;
+}
+
+// Packed databases
+//
+// File layout:
+//
+//   struct ot_pack_header_t
+//   uint64_t offsets[num_blocks+1] // From the start of the file
+//   blocks
+//   8 zero bytes
+//
+// Each block has up to block_size consecutive order types. With m = 2*n
+// coordinates per order type a block is:
+//
+//   uint16_t first[m]  // Coordinates of the first order type
+//   uint8_t widths[m]  // Bits used by each coordinate's deltas
+//   bits               // For each of the following order types, the zigzag
+//                      // coded difference of each coordinate against the
+//                      // previous order type, using widths[j] bits
+//
+// Points of order types in the database are sorted around p0, so consecutive
+// order types have close coordinates and deltas need few bits.
+//
+// NOTE: The bit stream is read and written 64 bits at a time with unaligned
+// little endian accesses, the padding at the end of the file makes this safe
+// for the last block.
+#define OT_PACK_MAGIC 0x4B50544F // "OTPK"
+#define OT_PACK_DEFAULT_BLOCK_SIZE 256
+
+struct ot_pack_header_t {
+    uint32_t magic;
+    uint32_t n;
+    uint32_t coord_size;
+    uint32_t block_size;
+    uint64_t num_order_types;
+    uint64_t num_blocks;
+};
+
+struct ot_pack_t {
+    int fd;
+    uint8_t *map;
+    uint64_t map_size;
+    struct ot_pack_header_t *header;
+    uint64_t *offsets;
+    int ot_size;
+
+    uint64_t block; // Currently decoded block, -1 if none
+    uint8_t *block_data; // Decoded block, in the same format of raw files
+};
+
+char* ot_pack_path (char *location, int n)
+{
+    char *dir_path = sh_expand (location, NULL);
+    char *full_path = malloc (strlen(dir_path)+strlen("otypesNN.pk.tmp")+1);
+    sprintf (full_path, "%sotypes%02d.pk", dir_path, n);
+    free (dir_path);
+    return full_path;
+}
+
+uint32_t zigzag_encode (int32_t val)
+{
+    return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+int32_t zigzag_decode (uint32_t val)
+{
+    return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+}
+
+void ot_pack_close (struct ot_pack_t *pack)
+{
+    if (pack->map != NULL) {
+        munmap (pack->map, pack->map_size);
+    }
+    if (pack->fd > 0) {
+        close (pack->fd);
+    }
+    free (pack->block_data);
+    free (pack);
+}
+
+// Returns NULL if there is no valid packed file for _n_ in _location_.
+struct ot_pack_t* ot_pack_open (char *location, int n)
+{
+    char *path = ot_pack_path (location, n);
+    int fd = open (path, O_RDONLY);
+    free (path);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct ot_pack_t *pack = calloc (1, sizeof(struct ot_pack_t));
+    pack->fd = fd;
+    pack->block = -1;
+
+    struct stat st;
+    if (fstat (fd, &st) == -1 || st.st_size < sizeof(struct ot_pack_header_t)) {
+        ot_pack_close (pack);
+        return NULL;
+    }
+
+    void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ot_pack_close (pack);
+        return NULL;
+    }
+    pack->map = map;
+    pack->map_size = st.st_size;
+    pack->header = (struct ot_pack_header_t*)pack->map;
+    pack->offsets = (uint64_t*)(pack->map + sizeof(struct ot_pack_header_t));
+
+    struct ot_pack_header_t *h = pack->header;
+    uint64_t offsets_end = sizeof(*h) + (h->num_blocks+1)*sizeof(uint64_t);
+    if (h->magic != OT_PACK_MAGIC || h->n != n || h->coord_size != db_coord_size (n) ||
+        h->num_order_types != db_num_order_types (n) || h->block_size == 0 ||
+        h->num_blocks != (h->num_order_types + h->block_size - 1)/h->block_size ||
+        offsets_end > st.st_size || pack->offsets[h->num_blocks] + 8 > st.st_size) {
+        printf ("Invalid packed database for n=%d.\n", n);
+        ot_pack_close (pack);
+        return NULL;
+    }
+
+    pack->ot_size = 2*n*h->coord_size/8;
+    pack->block_data = malloc (h->block_size*pack->ot_size);
+    return pack;
+}
+
+void ot_pack_decode_block (struct ot_pack_t *pack, uint64_t block)
+{
+    struct ot_pack_header_t *h = pack->header;
+    int m = 2*h->n;
+    uint64_t first_id = block*h->block_size;
+    uint32_t count = MIN (h->block_size, h->num_order_types - first_id);
+
+    uint8_t *src = pack->map + pack->offsets[block];
+    uint16_t coord[m];
+    memcpy (coord, src, m*sizeof(uint16_t));
+    uint8_t *widths = src + m*sizeof(uint16_t);
+    uint8_t *bits = widths + m;
+
+    uint64_t pos = 0;
+    uint32_t i;
+    int j;
+    for (i=0; i<count; i++) {
+        if (i > 0) {
+            for (j=0; j<m; j++) {
+                uint64_t word;
+                memcpy (&word, bits + pos/8, sizeof(word));
+                uint32_t delta = (word >> (pos%8)) & ((UINT64_C(1) << widths[j]) - 1);
+                coord[j] += zigzag_decode (delta);
+                pos += widths[j];
+            }
+        }
+
+        if (h->coord_size == 16) {
+            memcpy (pack->block_data + i*pack->ot_size, coord, m*sizeof(uint16_t));
+        } else {
+            uint8_t *dst = pack->block_data + i*pack->ot_size;
+            for (j=0; j<m; j++) {
+                dst[j] = coord[j];
+            }
+        }
+    }
+    pack->block = block;
+}
+
+// Returns a pointer to the raw coordinates of order type _id_. The pointer is
+// valid until an order type from a different block is requested.
+void* ot_pack_data (struct ot_pack_t *pack, uint64_t id)
+{
+    uint64_t block = id/pack->header->block_size;
+    if (block != pack->block) {
+        ot_pack_decode_block (pack, block);
+    }
+    return pack->block_data + (id%pack->header->block_size)*pack->ot_size;
+}
 
 void check_database (char *db_location, int missing[10], int *num_missing)
 {
@@ -54,8 +243,12 @@ void check_database (char *db_location, int missing[10], int *num_missing)
     for (i=3; i<11; i++) {
         strcpy (f_loc, otdb_names[i]);
         if (stat(full_path, &st) == -1 && errno == ENOENT) {
-            missing[*num_missing] = i;
-            (*num_missing)++;
+            char *pack_path = ot_pack_path (db_location, i);
+            if (stat(pack_path, &st) == -1 && errno == ENOENT) {
+                missing[*num_missing] = i;
+                (*num_missing)++;
+            }
+            free (pack_path);
         }
     }
     free (full_path);
@@ -100,51 +293,267 @@ void ensure_full_database (char *db_source, char *db_location)
 }
 #endif /*http_hpp*/
 
-int open_database (int n)
+// Prefetching
+//
+// While prefetching, a background thread reads order types following the
+// cursor of an ot_db_t into a ring buffer of _depth_ order types, and
+// ot_db_next() takes them from there. The thread blocks when the ring is
+// full, so it's never more than _depth_ order types ahead. Like
+// ot_db_next(), it continues from the start after the last order type.
+//
+// ot_db_seek() and ot_db_prev() restart prefetching from the new position. If
+// the thread fails to read, ot_db_next() stops prefetching and falls back to
+// reading the database itself.
+struct ot_db_prefetch_t {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    bool stop;
+    bool failed;
+
+    int n;
+    uint32_t depth;
+    uint64_t head; // Number of order types written into the ring
+    uint64_t tail; // Number of order types taken from the ring
+    uint64_t *ids;
+    ivec2 *pts;
+
+    uint64_t start_id;
+    ot_db_stream_t st;
+};
+
+void* ot_db_prefetch_thread (void *arg)
 {
-    if (__g_db_data.location == NULL) {
-        __g_db_data.location = CONFIG_DIR;
+    struct ot_db_prefetch_t *pf = (struct ot_db_prefetch_t*)arg;
+    order_type_t *ot = order_type_new (pf->n, NULL);
+    ot_db_stream_range (&pf->st, pf->start_id, pf->st.num_order_types);
+
+    while (1) {
+        if (!ot_db_stream_next (&pf->st, ot)) {
+            ot_db_stream_range (&pf->st, 0, pf->st.num_order_types);
+            if (!ot_db_stream_next (&pf->st, ot)) {
+                // NOTE: Wake up the consumer, otherwise it would wait for
+                // the empty ring forever.
+                pthread_mutex_lock (&pf->mutex);
+                pf->failed = true;
+                pthread_cond_signal (&pf->not_empty);
+                pthread_mutex_unlock (&pf->mutex);
+                break;
+            }
+        }
+
+        pthread_mutex_lock (&pf->mutex);
+        while (pf->head - pf->tail == pf->depth && !pf->stop) {
+            pthread_cond_wait (&pf->not_full, &pf->mutex);
+        }
+        if (pf->stop) {
+            pthread_mutex_unlock (&pf->mutex);
+            break;
+        }
+        uint64_t pos = pf->head%pf->depth;
+        pf->ids[pos] = ot->id;
+        memcpy (pf->pts + pos*pf->n, ot->pts, pf->n*sizeof(ivec2));
+        pf->head++;
+        pthread_cond_signal (&pf->not_empty);
+        pthread_mutex_unlock (&pf->mutex);
     }
 
-    if (__g_db_data.source == NULL) {
-        __g_db_data.source = DEFAULT_DB_SOURCE;
+    free (ot);
+    return NULL;
+}
+
+// Starts prefetching the order types after the current one. A _depth_ of 0
+// uses a default of 4096 order types.
+void ot_db_prefetch_start (ot_db_t *db, uint32_t depth)
+{
+    ot_db_prefetch_stop (db);
+    if (depth == 0) {
+        depth = 4096;
     }
 
-    if (__g_db_data.db) {
-        close(__g_db_data.db);
+    struct ot_db_prefetch_t *pf = calloc (1, sizeof(struct ot_db_prefetch_t));
+    pthread_mutex_init (&pf->mutex, NULL);
+    pthread_cond_init (&pf->not_empty, NULL);
+    pthread_cond_init (&pf->not_full, NULL);
+    pf->n = db->n;
+    pf->depth = depth;
+    pf->ids = malloc (depth*sizeof(uint64_t));
+    pf->pts = malloc (depth*db->n*sizeof(ivec2));
+    // NOTE: indx is -1 right after ot_db_open().
+    pf->start_id = db->indx+1 < db->num_order_types ? db->indx+1 : 0;
+
+    pf->st.location = db->location;
+    if (!ot_db_stream_open (&pf->st, db->n)) {
+        free (pf->ids);
+        free (pf->pts);
+        free (pf);
+        return;
     }
-    __g_db_data.n = n;
-    __g_db_data.indx = -1;
-    __g_db_data.eof_reached = 0;
-    __g_db_data.num_order_types = db_num_order_types(n);
-    __g_db_data.coord_size = db_coord_size (n);
-    __g_db_data.ot_size = 2*n*__g_db_data.coord_size/8;
 
-    char *dir_path = sh_expand (__g_db_data.location, NULL);
-    char *full_path = malloc (strlen(dir_path)+strlen(otdb_names[10])+1);
-    char *f_loc = stpcpy (full_path, dir_path);
-    strcpy (f_loc, otdb_names[n]);
+    db->prefetch = pf;
+    pthread_create (&pf->thread, NULL, ot_db_prefetch_thread, pf);
+}
+
+void ot_db_prefetch_stop (ot_db_t *db)
+{
+    struct ot_db_prefetch_t *pf = db->prefetch;
+    if (pf == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock (&pf->mutex);
+    pf->stop = true;
+    pthread_cond_signal (&pf->not_full);
+    pthread_mutex_unlock (&pf->mutex);
+    pthread_join (pf->thread, NULL);
 
-    __g_db_data.db = open (full_path, O_RDONLY);
+    ot_db_stream_close (&pf->st);
+    pthread_mutex_destroy (&pf->mutex);
+    pthread_cond_destroy (&pf->not_empty);
+    pthread_cond_destroy (&pf->not_full);
+    free (pf->ids);
+    free (pf->pts);
+    free (pf);
+    db->prefetch = NULL;
+
+    // NOTE: The file offset wasn't moved while prefetching, leave it where
+    // ot_db_read() expects it.
+    if (!db->map && !db->pack) {
+        lseek (db->db, (off_t)(db->indx+1)*db->ot_size, SEEK_SET);
+    }
+}
+
+// Takes the next order type from the ring. Returns false if the prefetching
+// thread failed before producing it, prefetching is stopped in that case.
+bool ot_db_prefetch_next (ot_db_t *db, order_type_t *ot)
+{
+    struct ot_db_prefetch_t *pf = db->prefetch;
+    pthread_mutex_lock (&pf->mutex);
+    while (pf->head == pf->tail && !pf->failed) {
+        pthread_cond_wait (&pf->not_empty, &pf->mutex);
+    }
+    if (pf->head == pf->tail) {
+        pthread_mutex_unlock (&pf->mutex);
+        printf ("Prefetching order types failed, reading without it.\n");
+        ot_db_prefetch_stop (db);
+        return false;
+    }
+    uint64_t pos = pf->tail%pf->depth;
+    ot->id = pf->ids[pos];
+    memcpy (ot->pts, pf->pts + pos*pf->n, pf->n*sizeof(ivec2));
+    pf->tail++;
+    pthread_cond_signal (&pf->not_full);
+    pthread_mutex_unlock (&pf->mutex);
+
+    db->eof_reached = db->indx+1 >= db->num_order_types;
+    db->indx = ot->id;
+    return true;
+}
+
+// Opens the database of order types of size _n_ into the handle _db_. If _db_
+// was already open, it's closed first. Location and source of the database are
+// taken from _db_, if unset we use the ones of the default handle (see
+// setup_db()).
+int ot_db_open (ot_db_t *db, int n)
+{
+    if (db->location == NULL) {
+        db->location = __g_db_data.location != NULL ? __g_db_data.location : CONFIG_DIR;
+    }
+
+    if (db->source == NULL) {
+        db->source = __g_db_data.source != NULL ? __g_db_data.source : DEFAULT_DB_SOURCE;
+    }
+
+    ot_db_close (db);
+
+    db->n = n;
+    db->indx = -1;
+    db->eof_reached = 0;
+    db->num_order_types = db_num_order_types(n);
+    db->coord_size = db_coord_size (n);
+    db->ot_size = 2*n*db->coord_size/8;
+
+    if (db->format != OT_DB_FORMAT_RAW) {
+        db->pack = ot_pack_open (db->location, n);
+        if (db->pack != NULL) {
+            return 1;
+        } else if (db->format == OT_DB_FORMAT_PACKED) {
+            invalid_code_path;
+            return 0;
+        }
+    }
+
+    char *full_path = db_file_path (db->location, n);
+    db->db = open (full_path, O_RDONLY);
     free (full_path);
-    free (dir_path);
-    if (__g_db_data.db == -1) {
+    if (db->db == -1) {
+        db->db = 0;
         invalid_code_path;
         return 0;
     }
 
+    // NOTE: We only use the mapping if the file is complete, a truncated
+    // database would make us touch pages past the end of the file (SIGBUS).
+    // In that case, or if mmap() fails, the read() based code is used.
+    struct stat st;
+    uint64_t expected_size = db->num_order_types*db->ot_size;
+    if (fstat (db->db, &st) == 0 && st.st_size >= expected_size) {
+        void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, db->db, 0);
+        if (map != MAP_FAILED) {
+            db->map = map;
+            db->map_size = st.st_size;
+        }
+    }
+
     return 1;
 }
 
-int read_ot_from_db (order_type_t *ot)
+void ot_db_close (ot_db_t *db)
 {
-    int eof = 0;
-    if (!read (__g_db_data.db, &__g_db_data.buff, __g_db_data.ot_size)) {
-        return 0;
+    ot_db_prefetch_stop (db);
+
+    if (db->pack) {
+        ot_pack_close (db->pack);
+        db->pack = NULL;
     }
 
-    void *coord = __g_db_data.buff;
-    if (__g_db_data.coord_size == 16) {
+    if (db->map) {
+        munmap (db->map, db->map_size);
+        db->map = NULL;
+        db->map_size = 0;
+    }
+
+    if (db->db) {
+        close (db->db);
+        db->db = 0;
+    }
+}
+
+// Returns a pointer to the raw coordinates of order type _id_ inside the
+// memory mapped database, no copy is made. Returns NULL if the database isn't
+// mapped or _id_ is out of range.
+//
+// For packed databases the pointer is into the decoded block, and is valid
+// until an order type of a different block is read from _db_.
+void* ot_db_data (ot_db_t *db, uint64_t id)
+{
+    if (id >= db->num_order_types) {
+        return NULL;
+    }
+
+    if (db->pack) {
+        return ot_pack_data (db->pack, id);
+    } else if (db->map) {
+        return db->map + id*db->ot_size;
+    } else {
+        return NULL;
+    }
+}
+
+void db_decode_coords (int coord_size, void *coord, order_type_t *ot)
+{
+    if (coord_size == 16) {
         int i;
         for (i=0; i<ot->n; i++) {
             ot->pts[i].x = ((uint16_t*)coord)[2*i];
@@ -157,62 +566,746 @@ int read_ot_from_db (order_type_t *ot)
             ot->pts[i].y = ((uint8_t*)coord)[2*i+1];
         }
     }
-    return !eof;
 }
 
-void db_next (order_type_t *ot)
+void ot_db_decode (ot_db_t *db, void *coord, order_type_t *ot)
+{
+    db_decode_coords (db->coord_size, coord, ot);
+}
+
+int ot_db_read (ot_db_t *db, order_type_t *ot)
+{
+    if (!read (db->db, &db->buff, db->ot_size)) {
+        return 0;
+    }
+
+    ot_db_decode (db, db->buff, ot);
+    return 1;
+}
+
+void ot_db_next (ot_db_t *db, order_type_t *ot)
 {
-    assert (ot->n == __g_db_data.n);
+    assert (ot->n == db->n);
+
+    if (db->prefetch && ot_db_prefetch_next (db, ot)) {
+        // NOTE: Taken from the prefetching ring, see ot_db_prefetch_next().
 
-    if (!read_ot_from_db (ot)) {
-        __g_db_data.eof_reached = 1;
-        lseek (__g_db_data.db, 0, SEEK_SET);
-        read_ot_from_db (ot);
-        __g_db_data.indx = 0;
+    } else if (db->map || db->pack) {
+        // NOTE: indx starts at -1 after ot_db_open(), so the first call
+        // returns order type 0.
+        if (db->indx+1 >= db->num_order_types) {
+            db->eof_reached = 1;
+            db->indx = 0;
+        } else {
+            db->indx++;
+            db->eof_reached = 0;
+        }
+        ot_db_decode (db, ot_db_data (db, db->indx), ot);
+
+    } else if (!ot_db_read (db, ot)) {
+        db->eof_reached = 1;
+        lseek (db->db, 0, SEEK_SET);
+        ot_db_read (db, ot);
+        db->indx = 0;
     } else {
-        __g_db_data.indx++;
-        __g_db_data.eof_reached = 0;
+        db->indx++;
+        db->eof_reached = 0;
     }
-    ot->id = __g_db_data.indx;
+    ot->id = db->indx;
 }
 
-int db_is_eof ()
+int ot_db_is_eof (ot_db_t *db)
 {
-    return __g_db_data.eof_reached;
+    return db->eof_reached;
 }
 
-void db_prev (order_type_t *ot)
+void ot_db_prev (ot_db_t *db, order_type_t *ot)
 {
-    if (-1 == lseek (__g_db_data.db, -2*__g_db_data.ot_size, SEEK_CUR)) {
+    if (db->prefetch) {
+        uint32_t depth = db->prefetch->depth;
+        ot_db_prefetch_stop (db);
+        ot_db_prev (db, ot);
+        ot_db_prefetch_start (db, depth);
+        return;
+    }
+
+    if (db->map || db->pack) {
+        if (db->indx == 0 || db->indx >= db->num_order_types) {
+            db->indx = db->num_order_types - 1;
+        } else {
+            db->indx--;
+        }
+        ot->id = db->indx;
+        ot_db_decode (db, ot_db_data (db, db->indx), ot);
+        return;
+    }
+
+    if (-1 == lseek (db->db, -2*db->ot_size, SEEK_CUR)) {
         if (errno == EINVAL) {
-            lseek (__g_db_data.db, -__g_db_data.ot_size, SEEK_END);
-            __g_db_data.indx = __g_db_data.num_order_types - 1;
+            lseek (db->db, -db->ot_size, SEEK_END);
+            db->indx = db->num_order_types - 1;
         }
     } else {
-        __g_db_data.indx--;
+        db->indx--;
     }
-    ot->id = __g_db_data.indx;
-    read_ot_from_db (ot);
+    ot->id = db->indx;
+    ot_db_read (db, ot);
 }
 
-void db_seek (order_type_t *ot, uint64_t id)
+void ot_db_seek (ot_db_t *db, order_type_t *ot, uint64_t id)
 {
-    // TODO: This hasn't been tested for n>10, if we get the file for n=11,
-    // this may throw EOVERFLOW, check it doesn't.
-    if (id < __g_db_data.num_order_types) {
-        __g_db_data.indx = id;
-        ot->id = __g_db_data.indx;
-        if (-1 == lseek (__g_db_data.db, id*__g_db_data.ot_size, SEEK_SET)) {
+    if (db->prefetch) {
+        uint32_t depth = db->prefetch->depth;
+        ot_db_prefetch_stop (db);
+        ot_db_seek (db, ot, id);
+        ot_db_prefetch_start (db, depth);
+        return;
+    }
+
+    if (id < db->num_order_types) {
+        db->indx = id;
+        ot->id = db->indx;
+
+        if (db->map || db->pack) {
+            ot_db_decode (db, ot_db_data (db, id), ot);
+            return;
+        }
+
+        // NOTE: The offset for n=11 is bigger than 32 bits, off_t is 64 bits
+        // on the platforms we care about, EOVERFLOW would mean it isn't.
+        if (-1 == lseek (db->db, (off_t)id*db->ot_size, SEEK_SET)) {
             if (errno == EOVERFLOW) {
                 printf ("File offset too big\n");
             }
         }
-        read_ot_from_db (ot);
+        ot_db_read (db, ot);
     } else {
         printf ("There is no order type with that index\n");
     }
 }
 
+// Streaming
+//
+// Sweeps over the database for n=11 can't rely on the memory mapping used by
+// ot_db_t, the file doesn't fit in the page cache and page faults happen one
+// page at a time. Here we read blocks of several megabytes with pread() and
+// use posix_fadvise() so the kernel reads the next block while we process the
+// current one.
+#define OT_DB_STREAM_BUFF_SIZE megabyte(4)
+
+int ot_db_stream_open (ot_db_stream_t *st, int n)
+{
+    if (st->location == NULL) {
+        st->location = __g_db_data.location != NULL ? __g_db_data.location : CONFIG_DIR;
+    }
+    char *location = st->location;
+
+    ot_db_stream_close (st);
+    st->location = location;
+    st->n = n;
+    st->num_order_types = db_num_order_types (n);
+    st->coord_size = db_coord_size (n);
+    st->ot_size = 2*n*st->coord_size/8;
+
+    // NOTE: Packed files are memory mapped, prefetching is left to the kernel.
+    st->pack = ot_pack_open (location, n);
+    if (st->pack != NULL) {
+        madvise (st->pack->map, st->pack->map_size, MADV_SEQUENTIAL);
+        ot_db_stream_range (st, 0, st->num_order_types);
+        return 1;
+    }
+
+    char *full_path = db_file_path (location, n);
+    st->fd = open (full_path, O_RDONLY);
+    free (full_path);
+    if (st->fd == -1) {
+        st->fd = 0;
+        invalid_code_path;
+        return 0;
+    }
+    posix_fadvise (st->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    st->buff_capacity = OT_DB_STREAM_BUFF_SIZE/st->ot_size;
+    st->buff = malloc (st->buff_capacity*st->ot_size);
+    ot_db_stream_range (st, 0, st->num_order_types);
+    return 1;
+}
+
+void ot_db_stream_close (ot_db_stream_t *st)
+{
+    if (st->pack) {
+        ot_pack_close (st->pack);
+    }
+    if (st->fd) {
+        close (st->fd);
+    }
+    free (st->buff);
+    *st = (ot_db_stream_t){0};
+}
+
+// Makes the next calls to ot_db_stream_next() return order types with ids in
+// [start, end).
+void ot_db_stream_range (ot_db_stream_t *st, uint64_t start, uint64_t end)
+{
+    st->next_id = start;
+    st->end = MIN (end, st->num_order_types);
+    st->buff_first_id = start;
+    st->buff_count = 0;
+    if (st->pack) {
+        return;
+    }
+
+    uint64_t len = MIN (st->buff_capacity, st->end - MIN(start, st->end));
+    posix_fadvise (st->fd, (off_t)start*st->ot_size, len*st->ot_size, POSIX_FADV_WILLNEED);
+}
+
+bool ot_db_stream_fill (ot_db_stream_t *st)
+{
+    uint64_t count = MIN (st->buff_capacity, st->end - st->next_id);
+    uint64_t size = count*st->ot_size;
+    off_t offset = (off_t)st->next_id*st->ot_size;
+
+    uint64_t bytes_read = 0;
+    while (bytes_read < size) {
+        ssize_t status = pread (st->fd, st->buff + bytes_read, size - bytes_read, offset + bytes_read);
+        if (status == -1 && errno == EINTR) {
+            continue;
+        } else if (status <= 0) {
+            if (status == -1) {
+                printf ("Error reading database: %s\n", strerror(errno));
+            }
+            break;
+        }
+        bytes_read += status;
+    }
+
+    st->buff_first_id = st->next_id;
+    st->buff_count = bytes_read/st->ot_size;
+
+    uint64_t next = st->next_id + st->buff_count;
+    if (next < st->end) {
+        uint64_t len = MIN (st->buff_capacity, st->end - next);
+        posix_fadvise (st->fd, (off_t)next*st->ot_size, len*st->ot_size, POSIX_FADV_WILLNEED);
+    }
+
+    return st->buff_count > 0;
+}
+
+// Decodes the next order type of the range into _ot_. Returns false when
+// the end of the range was reached.
+bool ot_db_stream_next (ot_db_stream_t *st, order_type_t *ot)
+{
+    assert (ot->n == st->n);
+    if (st->next_id >= st->end) {
+        return false;
+    }
+
+    if (st->pack) {
+        db_decode_coords (st->coord_size, ot_pack_data (st->pack, st->next_id), ot);
+        ot->id = st->next_id;
+        st->next_id++;
+        return true;
+    }
+
+    if (st->next_id >= st->buff_first_id + st->buff_count) {
+        if (!ot_db_stream_fill (st)) {
+            return false;
+        }
+    }
+
+    db_decode_coords (st->coord_size,
+                      st->buff + (st->next_id - st->buff_first_id)*st->ot_size, ot);
+    ot->id = st->next_id;
+    st->next_id++;
+    return true;
+}
+
+struct ot_db_parallel_worker_t {
+    ot_db_parallel_t *par;
+    int id;
+};
+
+void* ot_db_parallel_worker (void *arg)
+{
+    struct ot_db_parallel_worker_t *wk = (struct ot_db_parallel_worker_t*)arg;
+    ot_db_parallel_t *par = wk->par;
+
+    ot_db_stream_t st = {0};
+    ot_db_stream_open (&st, par->n);
+    order_type_t *ot = order_type_new (par->n, NULL);
+
+    while (1) {
+        uint64_t start = __sync_fetch_and_add (&par->next_chunk, par->chunk_size);
+        if (start >= par->num_order_types) {
+            break;
+        }
+
+        ot_db_stream_range (&st, start, start + par->chunk_size);
+        while (ot_db_stream_next (&st, ot)) {
+            par->cb (ot, wk->id, par->closure);
+        }
+        __sync_fetch_and_add (&par->processed, st.end - start);
+    }
+
+    free (ot);
+    ot_db_stream_close (&st);
+    return NULL;
+}
+
+// Starts iterating all order types of size _n_ with _num_threads_ threads (or
+// one per processor if it's 0), calling _cb_ on each one. Returns
+// immediately, ot_db_parallel_wait() must be called to join the threads.
+void ot_db_parallel_start (ot_db_parallel_t *par, int n, int num_threads, ot_db_for_cb_t *cb, void *closure)
+{
+    if (num_threads <= 0) {
+        num_threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+
+    par->n = n;
+    par->num_threads = num_threads;
+    par->num_order_types = db_num_order_types (n);
+    par->next_chunk = 0;
+    par->processed = 0;
+    par->cb = cb;
+    par->closure = closure;
+
+    // NOTE: Chunks need to be big for reads to be sequential, but there should
+    // be many more chunks than threads so they stay balanced when the cost
+    // per order type varies. For n=11 this gives chunks of 4096 order types
+    // (176KB), for small n we fall back to 256.
+    if (par->chunk_size == 0) {
+        par->chunk_size = par->num_order_types/(num_threads*512);
+        par->chunk_size = CLAMP (par->chunk_size, 256, 4096);
+    }
+
+    par->threads = malloc (num_threads*sizeof(pthread_t));
+    par->workers = malloc (num_threads*sizeof(struct ot_db_parallel_worker_t));
+    int i;
+    for (i=0; i<num_threads; i++) {
+        par->workers[i].par = par;
+        par->workers[i].id = i;
+        pthread_create (&par->threads[i], NULL, ot_db_parallel_worker, &par->workers[i]);
+    }
+}
+
+uint64_t ot_db_parallel_processed (ot_db_parallel_t *par)
+{
+    return __sync_fetch_and_add (&par->processed, 0);
+}
+
+void ot_db_parallel_wait (ot_db_parallel_t *par)
+{
+    int i;
+    for (i=0; i<par->num_threads; i++) {
+        pthread_join (par->threads[i], NULL);
+    }
+    free (par->threads);
+    free (par->workers);
+    par->threads = NULL;
+    par->workers = NULL;
+}
+
+void ot_db_parallel_for (int n, int num_threads, ot_db_for_cb_t *cb, void *closure)
+{
+    ot_db_parallel_t par = {0};
+    ot_db_parallel_start (&par, n, num_threads, cb, closure);
+    ot_db_parallel_wait (&par);
+}
+
+// Batch decoding
+//
+// Decoding a batch of consecutive order types is just widening a contiguous
+// stream of interleaved 8 or 16 bit coordinates into two arrays of 32 bit
+// integers, one for x and one for y. Points don't need to be handled per order
+// type, so the stream can be processed with SIMD. The kernel used is chosen at
+// runtime depending on what the CPU supports, db_set_simd() can be used to
+// force one of them (useful for benchmarking).
+
+#define DB_DECODE_KERNEL(name) void name(void *src, uint64_t num_pts, int32_t *x, int32_t *y)
+typedef DB_DECODE_KERNEL(db_decode_kernel_t);
+
+DB_DECODE_KERNEL(db_decode_u8_scalar)
+{
+    uint8_t *coord = src;
+    uint64_t i;
+    for (i=0; i<num_pts; i++) {
+        x[i] = coord[2*i];
+        y[i] = coord[2*i+1];
+    }
+}
+
+DB_DECODE_KERNEL(db_decode_u16_scalar)
+{
+    uint16_t *coord = src;
+    uint64_t i;
+    for (i=0; i<num_pts; i++) {
+        x[i] = coord[2*i];
+        y[i] = coord[2*i+1];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// NOTE: A 16 bit point is a 32 bit lane with x in the low half and y in the
+// high half, so deinterleaving is a mask and a shift. 8 bit points are handled
+// the same way in 16 bit lanes and then zero extended.
+
+__attribute__((target("sse4.1")))
+DB_DECODE_KERNEL(db_decode_u8_sse41)
+{
+    uint8_t *coord = src;
+    __m128i mask = _mm_set1_epi16 (0x00FF);
+    uint64_t i = 0;
+    for (; i+8 <= num_pts; i+=8) {
+        __m128i v = _mm_loadu_si128 ((__m128i*)(coord + 2*i));
+        __m128i x16 = _mm_and_si128 (v, mask);
+        __m128i y16 = _mm_srli_epi16 (v, 8);
+        _mm_storeu_si128 ((__m128i*)(x + i), _mm_cvtepu16_epi32 (x16));
+        _mm_storeu_si128 ((__m128i*)(x + i + 4), _mm_cvtepu16_epi32 (_mm_srli_si128 (x16, 8)));
+        _mm_storeu_si128 ((__m128i*)(y + i), _mm_cvtepu16_epi32 (y16));
+        _mm_storeu_si128 ((__m128i*)(y + i + 4), _mm_cvtepu16_epi32 (_mm_srli_si128 (y16, 8)));
+    }
+    db_decode_u8_scalar (coord + 2*i, num_pts - i, x + i, y + i);
+}
+
+__attribute__((target("sse4.1")))
+DB_DECODE_KERNEL(db_decode_u16_sse41)
+{
+    uint16_t *coord = src;
+    __m128i mask = _mm_set1_epi32 (0x0000FFFF);
+    uint64_t i = 0;
+    for (; i+4 <= num_pts; i+=4) {
+        __m128i v = _mm_loadu_si128 ((__m128i*)(coord + 2*i));
+        _mm_storeu_si128 ((__m128i*)(x + i), _mm_and_si128 (v, mask));
+        _mm_storeu_si128 ((__m128i*)(y + i), _mm_srli_epi32 (v, 16));
+    }
+    db_decode_u16_scalar (coord + 2*i, num_pts - i, x + i, y + i);
+}
+
+__attribute__((target("avx2")))
+DB_DECODE_KERNEL(db_decode_u8_avx2)
+{
+    uint8_t *coord = src;
+    __m256i mask = _mm256_set1_epi16 (0x00FF);
+    uint64_t i = 0;
+    for (; i+16 <= num_pts; i+=16) {
+        __m256i v = _mm256_loadu_si256 ((__m256i*)(coord + 2*i));
+        __m256i x16 = _mm256_and_si256 (v, mask);
+        __m256i y16 = _mm256_srli_epi16 (v, 8);
+        _mm256_storeu_si256 ((__m256i*)(x + i), _mm256_cvtepu16_epi32 (_mm256_castsi256_si128 (x16)));
+        _mm256_storeu_si256 ((__m256i*)(x + i + 8), _mm256_cvtepu16_epi32 (_mm256_extracti128_si256 (x16, 1)));
+        _mm256_storeu_si256 ((__m256i*)(y + i), _mm256_cvtepu16_epi32 (_mm256_castsi256_si128 (y16)));
+        _mm256_storeu_si256 ((__m256i*)(y + i + 8), _mm256_cvtepu16_epi32 (_mm256_extracti128_si256 (y16, 1)));
+    }
+    db_decode_u8_scalar (coord + 2*i, num_pts - i, x + i, y + i);
+}
+
+__attribute__((target("avx2")))
+DB_DECODE_KERNEL(db_decode_u16_avx2)
+{
+    uint16_t *coord = src;
+    __m256i mask = _mm256_set1_epi32 (0x0000FFFF);
+    uint64_t i = 0;
+    for (; i+8 <= num_pts; i+=8) {
+        __m256i v = _mm256_loadu_si256 ((__m256i*)(coord + 2*i));
+        _mm256_storeu_si256 ((__m256i*)(x + i), _mm256_and_si256 (v, mask));
+        _mm256_storeu_si256 ((__m256i*)(y + i), _mm256_srli_epi32 (v, 16));
+    }
+    db_decode_u16_scalar (coord + 2*i, num_pts - i, x + i, y + i);
+}
+#endif
+
+db_decode_kernel_t *g_db_decode_u8 = NULL;
+db_decode_kernel_t *g_db_decode_u16 = NULL;
+
+// Sets the kernels used by ot_db_read_batch(). Returns false if the CPU
+// doesn't support the requested instruction set, in which case nothing
+// changes.
+bool db_set_simd (enum db_simd_t simd)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init ();
+    if (simd == DB_SIMD_AUTO) {
+        if (__builtin_cpu_supports ("avx2")) {
+            simd = DB_SIMD_AVX2;
+        } else if (__builtin_cpu_supports ("sse4.1")) {
+            simd = DB_SIMD_SSE41;
+        } else {
+            simd = DB_SIMD_SCALAR;
+        }
+    }
+
+    switch (simd) {
+        case DB_SIMD_AVX2:
+            if (!__builtin_cpu_supports ("avx2")) return false;
+            g_db_decode_u8 = db_decode_u8_avx2;
+            g_db_decode_u16 = db_decode_u16_avx2;
+            break;
+        case DB_SIMD_SSE41:
+            if (!__builtin_cpu_supports ("sse4.1")) return false;
+            g_db_decode_u8 = db_decode_u8_sse41;
+            g_db_decode_u16 = db_decode_u16_sse41;
+            break;
+        default:
+            g_db_decode_u8 = db_decode_u8_scalar;
+            g_db_decode_u16 = db_decode_u16_scalar;
+    }
+#else
+    if (simd != DB_SIMD_AUTO && simd != DB_SIMD_SCALAR) {
+        return false;
+    }
+    g_db_decode_u8 = db_decode_u8_scalar;
+    g_db_decode_u16 = db_decode_u16_scalar;
+#endif
+    return true;
+}
+
+ot_batch_t* ot_batch_new (int n, uint32_t capacity, mem_pool_t *pool)
+{
+    ot_batch_t *res = pom_push_struct (pool, ot_batch_t);
+    res->n = n;
+    res->capacity = capacity;
+    res->count = 0;
+    res->first_id = 0;
+    res->x = pom_push_array (pool, capacity*n, int32_t);
+    res->y = pom_push_array (pool, capacity*n, int32_t);
+    return res;
+}
+
+// Copies the order type at position _i_ of the batch into _ot_.
+void ot_batch_get (ot_batch_t *batch, uint32_t i, order_type_t *ot)
+{
+    assert (i < batch->count && ot->n == batch->n);
+    int32_t *x = batch->x + i*batch->n;
+    int32_t *y = batch->y + i*batch->n;
+    int j;
+    for (j=0; j<batch->n; j++) {
+        ot->pts[j].x = x[j];
+        ot->pts[j].y = y[j];
+    }
+    ot->id = batch->first_id + i;
+}
+
+// Decodes up to _count_ order types starting at _id_ into _batch_, returns the
+// number of decoded order types. This doesn't move the cursor of _db_.
+uint32_t ot_db_read_batch (ot_db_t *db, uint64_t id, uint32_t count, ot_batch_t *batch)
+{
+    assert (batch->n == db->n);
+    if (g_db_decode_u8 == NULL) {
+        db_set_simd (DB_SIMD_AUTO);
+    }
+    db_decode_kernel_t *kernel = db->coord_size == 16 ? g_db_decode_u16 : g_db_decode_u8;
+
+    batch->first_id = id;
+    batch->count = 0;
+    if (id >= db->num_order_types) {
+        return 0;
+    }
+    count = MIN (count, batch->capacity);
+    count = MIN (count, db->num_order_types - id);
+
+    if (db->pack) {
+        // NOTE: ot_db_data() is only valid inside a block.
+        uint32_t block_size = db->pack->header->block_size;
+        while (batch->count < count) {
+            uint64_t curr = id + batch->count;
+            uint32_t num = MIN (block_size - curr%block_size, count - batch->count);
+
+            uint64_t pos = (uint64_t)batch->count*db->n;
+            kernel (ot_db_data (db, curr), (uint64_t)num*db->n, batch->x + pos, batch->y + pos);
+            batch->count += num;
+        }
+
+    } else if (db->map) {
+        kernel (ot_db_data (db, id), (uint64_t)count*db->n, batch->x, batch->y);
+        batch->count = count;
+
+    } else {
+        // NOTE: Use pread() so the cursor used by ot_db_next() isn't moved.
+        uint8_t buff[kilobyte(64)];
+        uint32_t ots_per_read = sizeof(buff)/db->ot_size;
+        while (batch->count < count) {
+            uint32_t num = MIN (ots_per_read, count - batch->count);
+            off_t offset = (id + batch->count)*db->ot_size;
+            ssize_t bytes_read = pread (db->db, buff, num*db->ot_size, offset);
+            if (bytes_read <= 0) {
+                break;
+            }
+            num = bytes_read/db->ot_size;
+
+            uint64_t pos = (uint64_t)batch->count*db->n;
+            kernel (buff, (uint64_t)num*db->n, batch->x + pos, batch->y + pos);
+            batch->count += num;
+        }
+    }
+    return batch->count;
+}
+
+// Packs the raw database of order types of size _n_ into the format described
+// in "Packed databases", with _block_size_ order types per block (if 0 a
+// default is used). The file is written next to the raw one.
+bool ot_pack_write (int n, uint32_t block_size)
+{
+    if (block_size == 0) {
+        block_size = OT_PACK_DEFAULT_BLOCK_SIZE;
+    }
+
+    ot_db_t db = {0};
+    db.format = OT_DB_FORMAT_RAW;
+    if (!ot_db_open (&db, n)) {
+        return false;
+    }
+
+    mem_pool_t pool = {0};
+    int m = 2*n;
+    struct ot_pack_header_t header = {0};
+    header.magic = OT_PACK_MAGIC;
+    header.n = n;
+    header.coord_size = db.coord_size;
+    header.block_size = block_size;
+    header.num_order_types = db.num_order_types;
+    header.num_blocks = (header.num_order_types + block_size - 1)/block_size;
+
+    uint64_t *offsets = mem_pool_push_array (&pool, header.num_blocks+1, uint64_t);
+    ot_batch_t *batch = ot_batch_new (n, block_size, &pool);
+    // NOTE: Deltas of 16 bit coordinates need at most 17 bits, the extra 8
+    // bytes are for the 64 bit accesses when writing.
+    uint64_t max_block_size = m*sizeof(uint16_t) + m + ((uint64_t)block_size*m*17 + 7)/8 + 8;
+    uint8_t *block = mem_pool_push_size (&pool, max_block_size);
+
+    char *path = ot_pack_path (db.location, n);
+    char tmp_path[strlen(path)+5];
+    sprintf (tmp_path, "%s.tmp", path);
+    int file = open (tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (file == -1) {
+        printf ("Could not create %s: %s\n", tmp_path, strerror(errno));
+        free (path);
+        ot_db_close (&db);
+        mem_pool_destroy (&pool);
+        return false;
+    }
+
+    uint64_t offset = sizeof(header) + (header.num_blocks+1)*sizeof(uint64_t);
+    lseek (file, offset, SEEK_SET);
+
+    bool success = true;
+    uint64_t b;
+    for (b=0; b<header.num_blocks; b++) {
+        // NOTE: A short read would silently produce a truncated block that
+        // the reader accepts, stop instead.
+        uint32_t expected = MIN (block_size, header.num_order_types - b*block_size);
+        uint32_t count = ot_db_read_batch (&db, b*block_size, block_size, batch);
+        if (count != expected) {
+            printf ("Could not read order types [%"PRIu64", %"PRIu64") of %s.\n",
+                    b*block_size, b*block_size + expected, otdb_names[n]);
+            success = false;
+            break;
+        }
+
+        int32_t coord[count][m];
+        uint32_t i;
+        int j;
+        for (i=0; i<count; i++) {
+            for (j=0; j<n; j++) {
+                coord[i][2*j] = batch->x[i*n+j];
+                coord[i][2*j+1] = batch->y[i*n+j];
+            }
+        }
+
+        uint16_t *first = (uint16_t*)block;
+        uint8_t *widths = block + m*sizeof(uint16_t);
+        uint8_t *bits = widths + m;
+        for (j=0; j<m; j++) {
+            first[j] = coord[0][j];
+
+            uint32_t all = 0;
+            for (i=1; i<count; i++) {
+                all |= zigzag_encode (coord[i][j] - coord[i-1][j]);
+            }
+            widths[j] = all ? 32 - __builtin_clz (all) : 0;
+        }
+
+        uint64_t pos = 0;
+        memset (bits, 0, max_block_size - (bits - block));
+        for (i=1; i<count; i++) {
+            for (j=0; j<m; j++) {
+                uint64_t word;
+                memcpy (&word, bits + pos/8, sizeof(word));
+                word |= (uint64_t)zigzag_encode (coord[i][j] - coord[i-1][j]) << (pos%8);
+                memcpy (bits + pos/8, &word, sizeof(word));
+                pos += widths[j];
+            }
+        }
+
+        uint64_t size = (bits - block) + (pos + 7)/8;
+        offsets[b] = offset;
+        file_write (file, block, size);
+        offset += size;
+    }
+    offsets[header.num_blocks] = offset;
+
+    uint64_t padding = 0;
+    if (success) {
+        file_write (file, &padding, sizeof(padding));
+        lseek (file, 0, SEEK_SET);
+        file_write (file, &header, sizeof(header));
+        file_write (file, offsets, (header.num_blocks+1)*sizeof(uint64_t));
+
+        // NOTE: ot_db_open() prefers the packed file, make sure it's complete
+        // on disk before it replaces the previous one.
+        if (fsync (file) == -1) {
+            printf ("Could not write %s: %s\n", tmp_path, strerror(errno));
+            success = false;
+        }
+    }
+    close (file);
+
+    if (!success) {
+        unlink (tmp_path);
+    } else if (rename (tmp_path, path) == -1) {
+        printf ("Could not rename %s: %s\n", tmp_path, strerror(errno));
+        unlink (tmp_path);
+        success = false;
+    } else {
+        printf ("Packed %s: %"PRIu64" -> %"PRIu64" bytes\n", otdb_names[n],
+                db.num_order_types*db.ot_size, offset + sizeof(padding));
+    }
+
+    free (path);
+    ot_db_close (&db);
+    mem_pool_destroy (&pool);
+    return success;
+}
+
+int open_database (int n)
+{
+    return ot_db_open (&__g_db_data, n);
+}
+
+void db_next (order_type_t *ot)
+{
+    ot_db_next (&__g_db_data, ot);
+}
+
+int db_is_eof ()
+{
+    return ot_db_is_eof (&__g_db_data);
+}
+
+void db_prev (order_type_t *ot)
+{
+    ot_db_prev (&__g_db_data, ot);
+}
+
+void db_seek (order_type_t *ot, uint64_t id)
+{
+    ot_db_seek (&__g_db_data, ot, id);
+}
+
+void* db_ot_data (uint64_t id)
+{
+    return ot_db_data (&__g_db_data, id);
+}
+
 #define order_type_size(n) (sizeof(order_type_t)+(n-1)*sizeof(ivec2))
 order_type_t *order_type_new (int n, mem_pool_t *pool)
 {
@@ -230,6 +1323,15 @@ order_type_t *order_type_copy (mem_pool_t *pool, order_type_t *ot)
     return ret;
 }
 
+void compact_pts_from_ot (order_type_t *ot, i32vec2 *res)
+{
+    int i;
+    for (i=0; i<ot->n; i++) {
+        res[i].x = ot->pts[i].x;
+        res[i].y = ot->pts[i].y;
+    }
+}
+
 #define convex_ot(ot) convex_ot_scale (ot, 255/2)
 void convex_ot_scale (order_type_t *ot, int radius)
 {
@@ -276,7 +1378,7 @@ order_type_t* order_type_from_id (int n, uint64_t ot_id)
     if (ot_id == 0 && n>10) {
         convex_ot_searchable (res);
     } else {
-        assert (n<=10);
+        assert (n<=11);
         open_database (n);
         db_seek (res, ot_id);
     }
@@ -287,7 +1389,7 @@ void print_order_type (order_type_t *ot)
 {
     int i = 0;
     if (ot->id != -1) {
-        printf ("id: %"PRIu32"\n", ot->id);
+        printf ("id: %"PRIu64"\n", ot->id);
     } else {
         printf ("id: unknown\n");
     }
@@ -386,43 +1488,174 @@ ot_triples_t *ps_triples_new (dvec2 *points, int len, mem_pool_t *pool)
     return ret;
 }
 
-bool ot_triples_are_equal (ot_triples_t *tr_1, ot_triples_t *tr_2) {
-    if (tr_1->size != tr_2->size) {
-        return false;
+// Inverse of the numbering used by ot_triples_new(), triples are ordered
+// lexicographically over all ordered triples of distinct points.
+void triple_from_id (int n, int id, int *a, int *b, int *c)
+{
+    int per_first = (n-1)*(n-2);
+    *a = id/per_first;
+    int rest = id%per_first;
+
+    *b = rest/(n-2);
+    if (*b >= *a) {
+        (*b)++;
     }
 
-    int i;
-    for (i=0; i<tr_1->size; i++) {
-        if (tr_1->triples[i] != tr_2->triples[i]) {
-            return false;
-        }
+    *c = rest%(n-2);
+    int lo = MIN (*a, *b), hi = MAX (*a, *b);
+    if (*c >= lo) {
+        (*c)++;
+    }
+    if (*c >= hi) {
+        (*c)++;
     }
-    return true;
 }
 
-// TODO: This is very slow.
-void triple_from_id (int n, int id, int *a, int *b, int *c)
+static inline
+uint32_t binomial_2 (int m)
 {
-    uint32_t trip_id = 0;
+    return m < 2 ? 0 : m*(m-1)/2;
+}
+
+static inline
+uint32_t binomial_3 (int m)
+{
+    return m < 3 ? 0 : m*(m-1)*(m-2)/6;
+}
+
+// Lexicographic rank of the triple a<b<c among all triples of n points.
+uint32_t triple_rank (int n, int a, int b, int c)
+{
+    assert (a < b && b < c && c < n);
+    return binomial_3(n) - binomial_3(n-a) +
+           binomial_2(n-a-1) - binomial_2(n-b) +
+           c-b-1;
+}
+
+void triple_unrank (int n, uint32_t rank, int *a, int *b, int *c)
+{
+    int i = 0;
+    while (rank >= binomial_2(n-i-1)) {
+        rank -= binomial_2(n-i-1);
+        i++;
+    }
+    *a = i;
+
+    i++;
+    while (rank >= n-i-1) {
+        rank -= n-i-1;
+        i++;
+    }
+    *b = i;
+    *c = i+1+rank;
+}
+
+chirotope_t* chirotope_alloc (int n, mem_pool_t *pool)
+{
+    uint32_t num_triples = binomial_3 (n);
+    uint32_t num_words = MAX (1, (num_triples+63)/64);
+    chirotope_t *ret = pom_push_size (pool, sizeof(chirotope_t)+(num_words-1)*sizeof(uint64_t));
+    ret->n = n;
+    ret->num_triples = num_triples;
+    ret->num_words = num_words;
+    memset (ret->words, 0, num_words*sizeof(uint64_t));
+    return ret;
+}
+
+#define chirotope_set(ch,rank) ((ch)->words[(rank)/64] |= UINT64_C(1) << ((rank)%64))
+#define chirotope_get(ch,rank) (((ch)->words[(rank)/64] >> ((rank)%64)) & 1)
+#define chirotope_clear(ch,rank) ((ch)->words[(rank)/64] &= ~(UINT64_C(1) << ((rank)%64)))
+
+chirotope_t* chirotope_new (order_type_t *ot, mem_pool_t *pool)
+{
+    chirotope_t *ret = chirotope_alloc (ot->n, pool);
+
+    uint32_t rank = 0;
     int i, j, k;
-    for (i=0; i<n; i++) {
-        for (j=0; j<n; j++) {
-            if (j==i) {
-                continue;
-            }
-            for (k=0; k<n; k++) {
-                if (k==j || k==i) {
-                    continue;
+    for (i=0; i<ot->n; i++) {
+        for (j=i+1; j<ot->n; j++) {
+            for (k=j+1; k<ot->n; k++) {
+                if (left_i(ot->pts[i], ot->pts[j], ot->pts[k])) {
+                    chirotope_set (ret, rank);
                 }
-                if (trip_id == id) {
-                    *a=i;
-                    *b=j;
-                    *c=k;
+                rank++;
+            }
+        }
+    }
+    return ret;
+}
+
+// Returns NULL if any triple of _points_ is collinear, a chirotope only
+// stores one bit per triple so it can't represent them.
+chirotope_t* chirotope_from_points (dvec2 *points, int len, mem_pool_t *pool)
+{
+    chirotope_t *ret = chirotope_alloc (len, pool);
+
+    uint32_t rank = 0;
+    int i, j, k;
+    for (i=0; i<len; i++) {
+        for (j=i+1; j<len; j++) {
+            for (k=j+1; k<len; k++) {
+                double area = area_2 (points[i], points[j], points[k]);
+                if (area == 0) {
+                    return NULL;
+                } else if (area > 0) {
+                    chirotope_set (ret, rank);
                 }
-                trip_id ++;
+                rank++;
             }
         }
     }
+    return ret;
+}
+
+// Returns 1 if c is left of the directed line ab and -1 otherwise. Points
+// don't need to be sorted, the sign of the sorted triple is flipped for odd
+// permutations.
+int chirotope_sign (chirotope_t *ch, int a, int b, int c)
+{
+    bool odd = false;
+    if (a > b) { swap (&a, &b); odd = !odd; }
+    if (b > c) { swap (&b, &c); odd = !odd; }
+    if (a > b) { swap (&a, &b); odd = !odd; }
+
+    bool is_left = chirotope_get (ch, triple_rank (ch->n, a, b, c));
+    return (is_left != odd) ? 1 : -1;
+}
+
+bool chirotope_are_equal (chirotope_t *ch_1, chirotope_t *ch_2)
+{
+    if (ch_1->n != ch_2->n) {
+        return false;
+    }
+
+    // NOTE: Unused bits of the last word are always 0.
+    uint32_t i;
+    for (i=0; i<ch_1->num_words; i++) {
+        if (ch_1->words[i] != ch_2->words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Calls _callback_ with the rank of every triple that has different
+// orientation in _ch_1_ and _ch_2_, returns the number of differing triples.
+uint32_t chirotope_diff (chirotope_t *ch_1, chirotope_t *ch_2,
+                         chirotope_diff_cb_t *callback, void *closure)
+{
+    assert (ch_1->n == ch_2->n);
+    uint32_t count = 0;
+    uint32_t i;
+    for (i=0; i<ch_1->num_words; i++) {
+        uint64_t diff = ch_1->words[i] ^ ch_2->words[i];
+        count += __builtin_popcountll (diff);
+        while (callback != NULL && diff != 0) {
+            callback (ch_1->n, 64*i + __builtin_ctzll (diff), closure);
+            diff &= diff-1;
+        }
+    }
+    return count;
 }
 
 void print_triple (int n, int id) {
@@ -431,23 +1664,567 @@ void print_triple (int n, int id) {
     printf ("id:%d (%d, %d, %d)\n", id, a, b, c);
 }
 
+CHIROTOPE_DIFF_CB(print_triple_rank)
+{
+    int a, b, c;
+    triple_unrank (n, rank, &a, &b, &c);
+    printf ("rank:%u (%d, %d, %d)\n", rank, a, b, c);
+}
+
 void print_differing_triples (int n, uint64_t ot_id_1, uint64_t ot_id_2)
 {
+    mem_pool_t pool = {0};
     open_database (n);
-    order_type_t *ot_1 = order_type_new (n, NULL);
+    order_type_t *ot_1 = order_type_new (n, &pool);
     db_seek (ot_1, ot_id_1);
-    ot_triples_t *ot_triples_1 = ot_triples_new (ot_1, NULL);
+    chirotope_t *ch_1 = chirotope_new (ot_1, &pool);
 
-    order_type_t *ot_2 = order_type_new (n, NULL);
+    order_type_t *ot_2 = order_type_new (n, &pool);
     db_seek (ot_2, ot_id_2);
-    ot_triples_t *ot_triples_2 = ot_triples_new (ot_2, NULL);
+    chirotope_t *ch_2 = chirotope_new (ot_2, &pool);
+
+    chirotope_diff (ch_1, ch_2, print_triple_rank, NULL);
+    mem_pool_destroy (&pool);
+}
+
+
+// Orientation validator
+//
+// Keeps the orientations of a set of points and the number of them that are
+// different from the ones of a chirotope. When a single point moves only the
+// O(n^2) triples that contain it are recomputed.
+//
+// A collinear triple is always a violation. Its bit in val->curr is set to the
+// opposite of the expected orientation, so it's counted as a difference.
+void orientation_validator_init (orientation_validator_t *val, chirotope_t *ch, dvec2 *points,
+                                 mem_pool_t *pool)
+{
+    val->n = ch->n;
+    val->ch = ch;
+    val->curr = chirotope_alloc (ch->n, pool);
+    orientation_validator_reset (val, points);
+}
+
+// Recomputes all orientations, use it when more than a few points moved.
+uint32_t orientation_validator_reset (orientation_validator_t *val, dvec2 *points)
+{
+    memset (val->curr->words, 0, val->curr->num_words*sizeof(uint64_t));
+
+    uint32_t rank = 0;
+    int i, j, k;
+    for (i=0; i<val->n; i++) {
+        for (j=i+1; j<val->n; j++) {
+            for (k=j+1; k<val->n; k++) {
+                double area = area_2 (points[i], points[j], points[k]);
+                if (area > 0 || (area == 0 && !chirotope_get (val->ch, rank))) {
+                    chirotope_set (val->curr, rank);
+                }
+                rank++;
+            }
+        }
+    }
+
+    val->violations = chirotope_diff (val->ch, val->curr, NULL, NULL);
+    return val->violations;
+}
+
+// Updates the orientations after point _p_ moved, returns the number of
+// violations.
+uint32_t orientation_validator_move (orientation_validator_t *val, dvec2 *points, int p)
+{
+    int n = val->n;
+    int i, j;
+    for (i=0; i<n; i++) {
+        if (i == p) continue;
+
+        for (j=i+1; j<n; j++) {
+            if (j == p) continue;
+
+            int a = i, b = j, c = p;
+            if (p < i) {
+                a = p; b = i; c = j;
+            } else if (p < j) {
+                b = p; c = j;
+            }
+
+            uint32_t rank = triple_rank (n, a, b, c);
+            bool expected = chirotope_get (val->ch, rank);
+            bool was_wrong = chirotope_get (val->curr, rank) != expected;
+            double area = area_2 (points[a], points[b], points[c]);
+            bool bit = area > 0 || (area == 0 && !expected);
+            if (bit) {
+                chirotope_set (val->curr, rank);
+            } else {
+                chirotope_clear (val->curr, rank);
+            }
+            bool is_wrong = bit != expected;
+            val->violations += (int)is_wrong - (int)was_wrong;
+        }
+    }
+    return val->violations;
+}
+
+// Canonical form of an order type
+//
+// The points are relabeled starting at a convex hull point p, the rest are
+// labeled by their angular order around p in one of the two possible
+// directions. Using the clockwise direction also negates all orientations, so
+// a point set and its mirror image get the same canonical form, as they are
+// the same order type in the database. The canonical form is the
+// lexicographically smallest relabeled chirotope over all these choices, this
+// is the same idea as the normal form of λ-matrices, but computed directly
+// on the packed chirotope.
+
+// Expands _ch_ into a table with the sign of every ordered triple.
+static
+void chirotope_sign_table (chirotope_t *ch, int n, int8_t sign[n][n][n])
+{
+    uint32_t rank = 0;
+    int a, b, c;
+    for (a=0; a<n; a++) {
+        for (b=a+1; b<n; b++) {
+            for (c=b+1; c<n; c++) {
+                int8_t s = chirotope_get (ch, rank) ? 1 : -1;
+                sign[a][b][c] = sign[b][c][a] = sign[c][a][b] = s;
+                sign[b][a][c] = sign[a][c][b] = sign[c][b][a] = -s;
+                rank++;
+            }
+        }
+    }
+}
+
+static
+bool sign_table_in_hull (int n, int8_t sign[n][n][n], int p)
+{
+    // NOTE: p is in the convex hull if there is a q such that all other
+    // points are left of pq.
+    int q;
+    for (q=0; q<n; q++) {
+        if (q == p) continue;
+
+        bool in_hull = true;
+        int r;
+        for (r=0; r<n; r++) {
+            if (r != p && r != q && sign[p][q][r] != 1) {
+                in_hull = false;
+                break;
+            }
+        }
 
-    int32_t trip_id = 0;
-    while (trip_id < ot_triples_1->size) {
-        if (ot_triples_1->triples[trip_id] != ot_triples_2->triples[trip_id]) {
-            print_triple (n, trip_id);
+        if (in_hull) {
+            return true;
         }
-        trip_id++;
     }
+    return false;
 }
 
+// Labels starting at the convex hull point _p_, followed by the rest of the
+// points sorted around p counterclockwise if _dir_ is 1 or clockwise if it's
+// -1.
+static
+void sign_table_angular_labels (int n, int8_t sign[n][n][n], int p, int dir, int *labels)
+{
+    // Insertion sort of the rest of the points around p.
+    labels[0] = p;
+    int len = 1;
+    int q;
+    for (q=0; q<n; q++) {
+        if (q == p) continue;
+
+        int i = len;
+        while (i > 1 && dir*sign[p][labels[i-1]][q] < 0) {
+            labels[i] = labels[i-1];
+            i--;
+        }
+        labels[i] = q;
+        len++;
+    }
+}
+
+void chirotope_canonical (chirotope_t *ch, chirotope_t *res)
+{
+    int n = ch->n;
+    assert (res->n == n);
+
+    int8_t sign[n][n][n];
+    chirotope_sign_table (ch, n, sign);
+
+    uint64_t cand[res->num_words];
+    bool have_best = false;
+    int p;
+    for (p=0; p<n; p++) {
+        if (!sign_table_in_hull (n, sign, p)) {
+            continue;
+        }
+
+        int dir;
+        for (dir=1; dir>=-1; dir-=2) {
+            int labels[n];
+            sign_table_angular_labels (n, sign, p, dir, labels);
+
+            // NOTE: cmp is 0 while the candidate is equal to the best one
+            // found so far, -1 once it's known to be smaller.
+            int cmp = have_best ? 0 : -1;
+            memset (cand, 0, res->num_words*sizeof(uint64_t));
+            uint32_t rank = 0;
+            int a, b, c;
+            for (a=0; a<n && cmp<=0; a++) {
+                for (b=a+1; b<n && cmp<=0; b++) {
+                    for (c=b+1; c<n; c++) {
+                        uint64_t bit = dir*sign[labels[a]][labels[b]][labels[c]] > 0;
+                        cand[rank/64] |= bit << (rank%64);
+
+                        if (cmp == 0) {
+                            uint64_t best_bit = chirotope_get (res, rank);
+                            if (bit != best_bit) {
+                                cmp = bit < best_bit ? -1 : 1;
+                                if (cmp == 1) {
+                                    break;
+                                }
+                            }
+                        }
+                        rank++;
+                    }
+                }
+            }
+
+            if (cmp == -1) {
+                memcpy (res->words, cand, res->num_words*sizeof(uint64_t));
+                have_best = true;
+            }
+        }
+    }
+}
+
+// Stores in _res_ the permutations of the points that map _ch_ to itself or
+// to its mirror image, each one as an array of n elements where res[i*n+p] is
+// the image of point p. Returns the number of permutations found, which is
+// at most 2*n, the first one is always the identity.
+//
+// An automorphism maps convex hull points to convex hull points and
+// preserves the angular order around them up to the direction, so it's
+// determined by the image of a fixed hull point and the direction. Every
+// choice is checked by comparing the relabeled orientations, the same way
+// candidates are compared in chirotope_canonical().
+int chirotope_automorphisms (chirotope_t *ch, int *res)
+{
+    int n = ch->n;
+    int8_t sign[n][n][n];
+    chirotope_sign_table (ch, n, sign);
+
+    int p_0 = 0;
+    while (!sign_table_in_hull (n, sign, p_0)) {
+        p_0++;
+    }
+    int ref[n];
+    sign_table_angular_labels (n, sign, p_0, 1, ref);
+
+    int num_perms = 0;
+    int i;
+    for (i=0; i<n; i++) {
+        // NOTE: Start at p_0 so the identity is found first.
+        int p = (p_0+i)%n;
+        if (!sign_table_in_hull (n, sign, p)) {
+            continue;
+        }
+
+        int dir;
+        for (dir=1; dir>=-1; dir-=2) {
+            int labels[n];
+            sign_table_angular_labels (n, sign, p, dir, labels);
+
+            bool is_automorphism = true;
+            int a, b, c;
+            for (a=0; a<n && is_automorphism; a++) {
+                for (b=a+1; b<n && is_automorphism; b++) {
+                    for (c=b+1; c<n; c++) {
+                        if (sign[ref[a]][ref[b]][ref[c]] != dir*sign[labels[a]][labels[b]][labels[c]]) {
+                            is_automorphism = false;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (is_automorphism) {
+                int *perm = &res[num_perms*n];
+                for (a=0; a<n; a++) {
+                    perm[ref[a]] = labels[a];
+                }
+                num_perms++;
+            }
+        }
+    }
+    return num_perms;
+}
+
+uint64_t chirotope_hash (chirotope_t *ch)
+{
+    uint64_t h = ch->n;
+    uint32_t i;
+    for (i=0; i<ch->num_words; i++) {
+        h ^= ch->words[i];
+        h *= 0x9E3779B97F4A7C15;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+// Reverse lookup index
+//
+// For each n there is a file next to the database with an entry for each
+// order type, sorted by the hash of its canonical chirotope. A lookup
+// computes the hash of the query, finds it with a binary search and then
+// compares the canonical form of each candidate against the query's to
+// discard hash collisions.
+#define OT_INDEX_MAGIC 0x5849544F // "OTIX"
+
+struct ot_index_header_t {
+    uint32_t magic;
+    uint32_t n;
+    uint64_t num_entries;
+};
+
+struct ot_index_entry_t {
+    uint64_t hash;
+    uint32_t id;
+} __attribute__((packed));
+
+char* ot_index_path (int n)
+{
+    char *location = __g_db_data.location != NULL ? __g_db_data.location : CONFIG_DIR;
+    char *dir_path = sh_expand (location, NULL);
+    char *full_path = malloc (strlen(dir_path)+strlen("otypesNN.idx.tmp")+1);
+    sprintf (full_path, "%sotypes%02d.idx", dir_path, n);
+    free (dir_path);
+    return full_path;
+}
+
+struct ot_index_build_t {
+    int n;
+    uint64_t num_order_types;
+    uint64_t next_chunk; // Only modified atomically
+    struct ot_index_entry_t *entries;
+};
+
+void* ot_index_build_worker (void *arg)
+{
+    struct ot_index_build_t *bld = (struct ot_index_build_t*)arg;
+    uint64_t chunk_size = 1024;
+
+    mem_pool_t pool = {0};
+    ot_db_t db = {0};
+    ot_db_open (&db, bld->n);
+    order_type_t *ot = order_type_new (bld->n, &pool);
+    chirotope_t *canon = chirotope_alloc (bld->n, &pool);
+
+    while (1) {
+        uint64_t start = __sync_fetch_and_add (&bld->next_chunk, chunk_size);
+        if (start >= bld->num_order_types) {
+            break;
+        }
+        uint64_t end = MIN (start + chunk_size, bld->num_order_types);
+
+        uint64_t id;
+        for (id=start; id<end; id++) {
+            mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&pool);
+            ot_db_seek (&db, ot, id);
+            chirotope_t *ch = chirotope_new (ot, &pool);
+            chirotope_canonical (ch, canon);
+
+            bld->entries[id].hash = chirotope_hash (canon);
+            bld->entries[id].id = id;
+            mem_pool_end_temporary_memory (mrk);
+        }
+    }
+
+    ot_db_close (&db);
+    mem_pool_destroy (&pool);
+    return NULL;
+}
+
+int ot_index_entry_cmp (const void *a, const void *b)
+{
+    const struct ot_index_entry_t *e_a = a, *e_b = b;
+    if (e_a->hash != e_b->hash) {
+        return e_a->hash < e_b->hash ? -1 : 1;
+    }
+    return e_a->id < e_b->id ? -1 : (e_a->id > e_b->id);
+}
+
+// Builds the index for order types of size _n_ using _num_threads_ threads,
+// or one per processor if it's 0.
+bool ot_index_build (int n, int num_threads)
+{
+    if (num_threads <= 0) {
+        num_threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+
+    struct ot_index_build_t bld = {0};
+    bld.n = n;
+    bld.num_order_types = db_num_order_types (n);
+    bld.entries = malloc (bld.num_order_types*sizeof(struct ot_index_entry_t));
+    if (bld.entries == NULL) {
+        printf ("Could not allocate memory for the index of n=%d.\n", n);
+        return false;
+    }
+
+    pthread_t threads[num_threads];
+    int i;
+    for (i=0; i<num_threads; i++) {
+        pthread_create (&threads[i], NULL, ot_index_build_worker, &bld);
+    }
+    for (i=0; i<num_threads; i++) {
+        pthread_join (threads[i], NULL);
+    }
+
+    qsort (bld.entries, bld.num_order_types, sizeof(struct ot_index_entry_t), ot_index_entry_cmp);
+
+    bool success = true;
+    char *path = ot_index_path (n);
+    char tmp_path[strlen(path)+5];
+    sprintf (tmp_path, "%s.tmp", path);
+
+    int file = open (tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (file == -1) {
+        printf ("Could not create %s: %s\n", tmp_path, strerror(errno));
+        success = false;
+    } else {
+        struct ot_index_header_t header = {0};
+        header.magic = OT_INDEX_MAGIC;
+        header.n = n;
+        header.num_entries = bld.num_order_types;
+        file_write (file, &header, sizeof(header));
+        file_write (file, bld.entries, bld.num_order_types*sizeof(struct ot_index_entry_t));
+        close (file);
+
+        if (rename (tmp_path, path) == -1) {
+            printf ("Could not rename %s: %s\n", tmp_path, strerror(errno));
+            success = false;
+        }
+    }
+
+    free (path);
+    free (bld.entries);
+    return success;
+}
+
+void ot_index_build_all (int num_threads)
+{
+    int n;
+    for (n=3; n<11; n++) {
+        ot_index_build (n, num_threads);
+    }
+}
+
+// Opens the index of order types of size _n_, it must be built before with
+// ot_index_build().
+bool ot_index_open (ot_index_t *idx, int n)
+{
+    *idx = (ot_index_t){0};
+    char *path = ot_index_path (n);
+    idx->file = open (path, O_RDONLY);
+    free (path);
+    if (idx->file == -1) {
+        idx->file = 0;
+        return false;
+    }
+
+    struct stat st;
+    struct ot_index_header_t *header;
+    if (fstat (idx->file, &st) == -1 || st.st_size < sizeof(struct ot_index_header_t)) {
+        ot_index_close (idx);
+        return false;
+    }
+
+    idx->map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, idx->file, 0);
+    if (idx->map == MAP_FAILED) {
+        idx->map = NULL;
+        ot_index_close (idx);
+        return false;
+    }
+    idx->map_size = st.st_size;
+
+    header = (struct ot_index_header_t*)idx->map;
+    if (header->magic != OT_INDEX_MAGIC || header->n != n ||
+        st.st_size < sizeof(*header) + header->num_entries*sizeof(struct ot_index_entry_t)) {
+        printf ("Invalid order type index for n=%d, rebuild it.\n", n);
+        ot_index_close (idx);
+        return false;
+    }
+
+    idx->n = n;
+    idx->num_entries = header->num_entries;
+    idx->entries = idx->map + sizeof(*header);
+    ot_db_open (&idx->db, n);
+    return true;
+}
+
+void ot_index_close (ot_index_t *idx)
+{
+    ot_db_close (&idx->db);
+    if (idx->map != NULL) {
+        munmap (idx->map, idx->map_size);
+    }
+    if (idx->file) {
+        close (idx->file);
+    }
+    *idx = (ot_index_t){0};
+}
+
+// Finds the id of the order type with chirotope _ch_. Returns false if it's
+// not in the database.
+bool ot_index_lookup (ot_index_t *idx, chirotope_t *ch, uint64_t *id)
+{
+    assert (ch->n == idx->n);
+    mem_pool_t pool = {0};
+    chirotope_t *canon = chirotope_alloc (idx->n, &pool);
+    chirotope_canonical (ch, canon);
+    uint64_t hash = chirotope_hash (canon);
+
+    struct ot_index_entry_t *entries = (struct ot_index_entry_t*)idx->entries;
+    uint64_t lo = 0, hi = idx->num_entries;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi-lo)/2;
+        if (entries[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    bool found = false;
+    order_type_t *ot = order_type_new (idx->n, &pool);
+    chirotope_t *cand_canon = chirotope_alloc (idx->n, &pool);
+    for (; lo < idx->num_entries && entries[lo].hash == hash; lo++) {
+        ot_db_seek (&idx->db, ot, entries[lo].id);
+        chirotope_t *cand = chirotope_new (ot, &pool);
+        chirotope_canonical (cand, cand_canon);
+        if (chirotope_are_equal (canon, cand_canon)) {
+            *id = entries[lo].id;
+            found = true;
+            break;
+        }
+    }
+
+    mem_pool_destroy (&pool);
+    return found;
+}
+
+bool ot_index_lookup_points (ot_index_t *idx, dvec2 *pts, int len, uint64_t *id)
+{
+    mem_pool_t pool = {0};
+    chirotope_t *ch = chirotope_from_points (pts, len, &pool);
+    bool found = ch != NULL && ot_index_lookup (idx, ch, id);
+    mem_pool_destroy (&pool);
+    return found;
+}
+
+bool ot_index_lookup_ot (ot_index_t *idx, order_type_t *ot, uint64_t *id)
+{
+    mem_pool_t pool = {0};
+    chirotope_t *ch = chirotope_new (ot, &pool);
+    bool found = ot_index_lookup (idx, ch, id);
+    mem_pool_destroy (&pool);
+    return found;
+}
@@ -2,16 +2,93 @@
  * Copiright (C) 2017 Santiago León O.
  */
 #if !defined(ORDER_TYPES_H)
+#include <sys/mman.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define DEFAULT_DB_SOURCE "http://www.ist.tugraz.at/aichholzer/research/rp/triangulations/ordertypes/data/"
 
 typedef struct {
     int n;
-    uint32_t id;
+    uint64_t id;
     ivec2 pts [1];
 } order_type_t;
 
-struct {
+// Compact points of an order type. Coordinates in the database use at most 16
+// bits, so 32 bit points are enough. Differences of coordinates still fit in
+// 32 bits, only the products computed by area_2_c() need 64 bits.
+typedef struct {
+    int32_t x;
+    int32_t y;
+} i32vec2;
+
+order_type_t* order_type_new (int n, mem_pool_t *pool);
+void compact_pts_from_ot (order_type_t *ot, i32vec2 *res);
+
+// Chirotope of a point set, one bit for each triple a<b<c, set if c is left
+// of the directed line ab. Triples are ranked lexicographically, use
+// chirotope_sign() for triples that are not sorted.
+typedef struct {
+    int n;
+    uint32_t num_triples;
+    uint32_t num_words;
+    uint64_t words[1];
+} chirotope_t;
+
+uint32_t triple_rank (int n, int a, int b, int c);
+void triple_unrank (int n, uint32_t rank, int *a, int *b, int *c);
+chirotope_t* chirotope_new (order_type_t *ot, mem_pool_t *pool);
+chirotope_t* chirotope_from_points (dvec2 *points, int len, mem_pool_t *pool);
+int chirotope_sign (chirotope_t *ch, int a, int b, int c);
+bool chirotope_are_equal (chirotope_t *ch_1, chirotope_t *ch_2);
+void chirotope_canonical (chirotope_t *ch, chirotope_t *res);
+int chirotope_automorphisms (chirotope_t *ch, int *res);
+uint64_t chirotope_hash (chirotope_t *ch);
+
+#define CHIROTOPE_DIFF_CB(name) void name(int n, uint32_t rank, void *closure)
+typedef CHIROTOPE_DIFF_CB(chirotope_diff_cb_t);
+uint32_t chirotope_diff (chirotope_t *ch_1, chirotope_t *ch_2,
+                         chirotope_diff_cb_t *callback, void *closure);
+
+typedef struct {
+    int n;
+    chirotope_t *ch;   // Expected orientations
+    chirotope_t *curr; // Orientations of the points
+    uint32_t violations; // Number of triples where they differ
+} orientation_validator_t;
+
+void orientation_validator_init (orientation_validator_t *val, chirotope_t *ch, dvec2 *points,
+                                 mem_pool_t *pool);
+uint32_t orientation_validator_reset (orientation_validator_t *val, dvec2 *points);
+uint32_t orientation_validator_move (orientation_validator_t *val, dvec2 *points, int p);
+
+// Besides the raw files from the website (.b08 and .b16), a database can be
+// stored in a packed file (.pk) created with ot_pack_write(). It's split in
+// blocks of consecutive order types, each block is delta coded and bit
+// packed, and there is an index with the offset of each block. Reading an
+// order type decodes only its block.
+enum ot_db_format_t {
+    OT_DB_FORMAT_AUTO, // Packed if the file exists, raw otherwise
+    OT_DB_FORMAT_RAW,
+    OT_DB_FORMAT_PACKED
+};
+
+struct ot_pack_t;
+bool ot_pack_write (int n, uint32_t block_size);
+
+// Handle to an open order type database file. Each handle has its own cursor,
+// so different threads can iterate the same (or a different) database at the
+// same time, as long as they don't share a handle.
+//
+// A zero initialized handle is closed:
+//
+//   ot_db_t db = {0};
+//   ot_db_open (&db, n);
+//   ...
+//   ot_db_close (&db);
+typedef struct {
     int db;
     int n;
     int coord_size; //bits per coordinate in database
@@ -20,15 +97,156 @@ struct {
     uint64_t num_order_types;
     uint64_t indx;
     uint32_t buff[40];
+
+    // If the database file could be memory mapped this points to its content,
+    // and reading an order type becomes pointer arithmetic. Otherwise it's NULL
+    // and we fall back to calling read() into buff.
+    uint8_t *map;
+    uint64_t map_size;
+
+    // Set before calling ot_db_open() to choose the file that will be used.
+    // If a packed file is opened then pack is not NULL, and order types are
+    // decoded from it instead of reading db or map.
+    enum ot_db_format_t format;
+    struct ot_pack_t *pack;
+
+    // Not NULL while prefetching, see ot_db_prefetch_start().
+    struct ot_db_prefetch_t *prefetch;
+
     char *source;
     char *location;
-} __g_db_data ;
+} ot_db_t;
+
+int ot_db_open (ot_db_t *db, int n);
+void ot_db_close (ot_db_t *db);
+void ot_db_next (ot_db_t *db, order_type_t *ot);
+void ot_db_seek (ot_db_t *db, order_type_t *ot, uint64_t id);
+void ot_db_prev (ot_db_t *db, order_type_t *ot);
+int ot_db_is_eof (ot_db_t *db);
+void* ot_db_data (ot_db_t *db, uint64_t id);
+void ot_db_prefetch_start (ot_db_t *db, uint32_t depth);
+void ot_db_prefetch_stop (ot_db_t *db);
+
+// Structure of arrays buffer where a batch of consecutive order types is
+// decoded. Point j of the i-th order type in the batch is
+// (x[i*n+j], y[i*n+j]), its id is first_id+i.
+typedef struct {
+    int n;
+    uint32_t capacity; // Maximum number of order types
+    uint32_t count; // Number of decoded order types
+    uint64_t first_id;
+    int32_t *x;
+    int32_t *y;
+} ot_batch_t;
+
+enum db_simd_t {
+    DB_SIMD_AUTO,
+    DB_SIMD_SCALAR,
+    DB_SIMD_SSE41,
+    DB_SIMD_AVX2
+};
+
+ot_batch_t* ot_batch_new (int n, uint32_t capacity, mem_pool_t *pool);
+uint32_t ot_db_read_batch (ot_db_t *db, uint64_t id, uint32_t count, ot_batch_t *batch);
+bool db_set_simd (enum db_simd_t simd);
+
+// Default handle used by the functions below. Code that only needs a single
+// cursor can keep using these.
+ot_db_t __g_db_data;
 
 int open_database (int n);
 void db_next (order_type_t *ot);
 void db_seek (order_type_t *ot, uint64_t id);
 void db_prev (order_type_t *ot);
 int db_is_eof ();
+void* db_ot_data (uint64_t id);
+#define db_read_batch(id,count,batch) ot_db_read_batch(&__g_db_data,id,count,batch)
+#define db_prefetch_start(depth) ot_db_prefetch_start(&__g_db_data,depth)
+#define db_prefetch_stop() ot_db_prefetch_stop(&__g_db_data)
+
+// Sequential reader for a range of a database. It reads big blocks with
+// pread() and asks the kernel to prefetch the next one, so it's meant for
+// sweeps over databases that don't fit in memory (n=11 is ~100GB). Unlike
+// ot_db_t it doesn't wrap around at the end of the range.
+//
+//   ot_db_stream_t st = {0};
+//   ot_db_stream_open (&st, n);
+//   ot_db_stream_range (&st, start, end);
+//   while (ot_db_stream_next (&st, ot)) {
+//       ...
+//   }
+//   ot_db_stream_close (&st);
+typedef struct {
+    char *location; // If NULL, the one of the default handle is used
+
+    int fd;
+    int n;
+    int coord_size;
+    int ot_size;
+    uint64_t num_order_types;
+
+    uint64_t next_id;
+    uint64_t end;
+
+    uint8_t *buff;
+    uint64_t buff_capacity; // In order types
+    uint64_t buff_first_id;
+    uint64_t buff_count;
+
+    struct ot_pack_t *pack; // Not NULL if reading from a packed file
+} ot_db_stream_t;
+
+int ot_db_stream_open (ot_db_stream_t *st, int n);
+void ot_db_stream_close (ot_db_stream_t *st);
+void ot_db_stream_range (ot_db_stream_t *st, uint64_t start, uint64_t end);
+bool ot_db_stream_next (ot_db_stream_t *st, order_type_t *ot);
+
+// Parallel iteration over all order types of a database. The range of ids is
+// split in chunks of consecutive order types, each thread streams the chunks
+// it takes and calls the callback for each order type. The callback receives
+// the index of the calling thread in [0, num_threads), so per thread state
+// can be kept in an array passed as closure.
+#define OT_DB_FOR_CB(name) void name(order_type_t *ot, int thread_id, void *closure)
+typedef OT_DB_FOR_CB(ot_db_for_cb_t);
+
+typedef struct {
+    int n;
+    int num_threads;
+    uint64_t chunk_size; // If 0 a default is chosen by ot_db_parallel_start()
+    uint64_t num_order_types;
+    uint64_t next_chunk; // Only modified atomically
+    uint64_t processed;  // Only modified atomically
+
+    ot_db_for_cb_t *cb;
+    void *closure;
+
+    pthread_t *threads;
+    struct ot_db_parallel_worker_t *workers;
+} ot_db_parallel_t;
+
+void ot_db_parallel_start (ot_db_parallel_t *par, int n, int num_threads, ot_db_for_cb_t *cb, void *closure);
+uint64_t ot_db_parallel_processed (ot_db_parallel_t *par);
+void ot_db_parallel_wait (ot_db_parallel_t *par);
+void ot_db_parallel_for (int n, int num_threads, ot_db_for_cb_t *cb, void *closure);
+
+// Handle to the index that maps chirotopes back to order type ids, see
+// ot_index_build().
+typedef struct {
+    int n;
+    int file;
+    uint8_t *map;
+    uint64_t map_size;
+    uint64_t num_entries;
+    void *entries;
+    ot_db_t db;
+} ot_index_t;
+
+bool ot_index_build (int n, int num_threads);
+bool ot_index_open (ot_index_t *idx, int n);
+void ot_index_close (ot_index_t *idx);
+bool ot_index_lookup (ot_index_t *idx, chirotope_t *ch, uint64_t *id);
+bool ot_index_lookup_points (ot_index_t *idx, dvec2 *pts, int len, uint64_t *id);
+bool ot_index_lookup_ot (ot_index_t *idx, order_type_t *ot, uint64_t *id);
 
 #define ORDER_TYPES_H
 #endif
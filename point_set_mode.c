@@ -128,7 +128,12 @@ void draw_entities (struct point_set_mode_t *st, app_graphics_t *graphics)
         }
     }
 
-    cairo_set_source_rgb (cr, 0, 0, 0);
+    // NOTE: Points are red if dragging them changed the order type.
+    if (st->validator.violations > 0) {
+        cairo_set_source_rgb (cr, 1, 0, 0);
+    } else {
+        cairo_set_source_rgb (cr, 0, 0, 0);
+    }
     for (i=0; i<n; i++) {
         char str[11];
         snprintf (str, ARRAY_SIZE(str), "%i", i);
@@ -163,191 +168,6 @@ void focus_order_type (app_graphics_t *graphics, struct point_set_mode_t *st)
     st->redraw_canvas = true;
 }
 
-// The following is an implementation of an algorithm that positions the points
-// in a point set automatically into a more friendly configuration than the one
-// found in the database. A more in depth discussion about it's design can be
-// found in the file auto_positioning_points.txt.
-
-void angular_force (dvec2 *points, order_type_t *ot, int v, int s_m, int p, int s_p, double h, dvec2 *res)
-{
-    dvec2 vs_m = dvec2_subs (points[s_m], points[v]);
-    dvec2 vp = dvec2_subs (points[p], points[v]);
-    dvec2 vs_p = dvec2_subs (points[s_p], points[v]);
-
-    double ang_a = dvec2_clockwise_angle_between (vs_m, vp);
-    double ang_b = dvec2_clockwise_angle_between (vp, vs_p);
-    if (!in_cone (vs_m, DVEC2(0,0), vs_p, vp)) {
-        double ang_c = dvec2_clockwise_angle_between (vs_m, vs_p);
-        if (dvec2_clockwise_angle_between (vs_p, vp) < (2*M_PI-ang_c)/2) {
-            ang_b = -dvec2_angle_between (vs_p, vp);
-        } else {
-            ang_a = -dvec2_angle_between (vs_m, vp);
-        }
-    }
-
-    dvec2 force_p = DVEC2 (vp.y, -vp.x); // Clockwise perpendicular vector to vp
-    dvec2_normalize (&force_p);
-    dvec2_mult_to (&force_p, (ang_b-ang_a)/(ang_a+ang_b)*h);
-    dvec2_add_to (&res[p], force_p);
-
-    //if (p==0) {
-    //    printf ("v: %d, (%d, %d, %d) = ", v, s_m, p, s_p);
-    //    dvec2_print (&force_p);
-    //}
-}
-
-// Computes the force between two points proportional to the difference in their
-// distance and length. When adding the resulting vector to a and it's inverse
-// to b it effectively moves points closer to being at distance length. The
-// value h is a positive value that determines the strength of the force.
-dvec2 spring_force_pts (dvec2 a, dvec2 b, double length, double h)
-{
-    dvec2 res;
-    dvec2 force = dvec2_subs (b, a);
-    double d = dvec2_norm (force);
-    if (d > 0) {
-        dvec2_normalize (&force);
-        res = dvec2_mult (force, h*(d-length));
-    } else {
-        res = DVEC2(0,0);
-    }
-    return res;
-}
-
-dvec2 spring_force (dvec2 *points, int a, int b, double length, double h)
-{
-    dvec2 p = points[a];
-    dvec2 p_next = points[b];
-    return spring_force_pts (p, p_next, length, h);
-}
-
-void arrange_points_start (struct arrange_points_state_t *alg_st, order_type_t *ot, dvec2 *points)
-{
-    int len = ot->n;
-    *alg_st = (struct arrange_points_state_t){0};
-    alg_st->ot = ot;
-    alg_st->sort = mem_pool_push_size(&alg_st->pool, sizeof(int)*len*(len-1));
-    int *sort_ptr = alg_st->sort;
-    int i;
-    for (i=0; i<len; i++) {
-        sort_all_points_p (ot, i, 0, sort_ptr);
-        sort_ptr += len-1;
-    }
-
-    alg_st->cvx_hull = mem_pool_push_size(&alg_st->pool, sizeof(int)*len);
-    convex_hull (ot, alg_st->cvx_hull, &alg_st->cvx_hull_len);
-
-    dvec2 cvx_hull_v2[len];
-    dvec2_idx_to_array (points, alg_st->cvx_hull, cvx_hull_v2, alg_st->cvx_hull_len);
-    alg_st->centroid = polygon_centroid (cvx_hull_v2, alg_st->cvx_hull_len);
-
-    alg_st->tgt_hull = mem_pool_push_size(&alg_st->pool, sizeof(dvec2)*alg_st->cvx_hull_len);
-    convex_point_set_radius (alg_st->cvx_hull_len, 0,
-                             points[alg_st->cvx_hull[0]], alg_st->centroid,
-                             alg_st->tgt_hull);
-    alg_st->tgt_radius = dvec2_norm (dvec2_subs(points[alg_st->cvx_hull[0]], alg_st->centroid));
-    alg_st->steps = 0;
-}
-
-// Returns true if the resulting point set is good enough to show to the user.
-bool arrange_points_end (struct arrange_points_state_t *alg_st, dvec2 *points, int len)
-{
-    bool res = true;
-    int i;
-    for (i=0; i < len; i++) {
-        dvec2_round (&points[i]);
-    }
-
-    box_t box;
-    get_bounding_box (points, len, &box);
-
-    for (i=0; i < len; i++) {
-        dvec2_subs_to (&points[i], DVEC2(box.min.x, box.min.y));
-    }
-
-    ot_triples_t *trip_ot = ot_triples_new (alg_st->ot, &alg_st->pool);
-    ot_triples_t *trip_pts = ps_triples_new (points, len, &alg_st->pool);
-    if (!ot_triples_are_equal (trip_ot, trip_pts)) {
-        res = false;
-    }
-
-    mem_pool_destroy(&alg_st->pool);
-    return res;
-}
-
-double arrange_points_step (struct arrange_points_state_t *alg_st, dvec2 *points, int len)
-{
-    order_type_t *ot = alg_st->ot;
-    alg_st->steps++;
-
-    dvec2 res[len];
-    int i;
-    for (i=0; i<len; i++) {
-        res[i] = (dvec2){0};
-    }
-
-    // Compute the sum of all angular forces on a point p
-    dvec2 tmp_forces[len];
-    for (i=0; i<len; i++) {
-        tmp_forces[i] = (dvec2){0};
-    }
-    int v;
-    for (v=0; v<len; v++) {
-        int *pts_arnd_v = &alg_st->sort[v*(len-1)];
-
-        double magnitude = alg_st->tgt_radius/(30*len);
-        angular_force (points, ot, v, pts_arnd_v[len-2], pts_arnd_v[0],
-                       pts_arnd_v[1], magnitude, tmp_forces);
-        int j;
-        for (j=0; j<len-3; j++) {
-            int s_m = pts_arnd_v[j];
-            int p = pts_arnd_v[j+1];
-            int s_p = pts_arnd_v[j+2];
-            angular_force (points, ot, v, s_m, p, s_p, magnitude, tmp_forces);
-        }
-
-        angular_force (points, ot, v, pts_arnd_v[j], pts_arnd_v[j+1],
-                       pts_arnd_v[0], magnitude, tmp_forces);
-    }
-
-    for (i=0; i<len; i++) {
-        dvec2_mult_to (&tmp_forces[i], 1);
-        dvec2_add_to (&res[i], tmp_forces[i]);
-    }
-
-    // Circular wall
-    for (i=0; i<alg_st->cvx_hull_len; i++) {
-        dvec2 r = dvec2_subs (points[alg_st->cvx_hull[i]], alg_st->centroid);
-        double dist = dvec2_norm(r) - alg_st->tgt_radius;
-        if (dist > 0) {
-            dvec2_normalize (&r);
-            double norm = dvec2_dot (res[alg_st->cvx_hull[i]], r);
-            dvec2_mult_to (&r, -(norm + 0.01*dist));
-            dvec2_add_to (&res[alg_st->cvx_hull[i]], r);
-        }
-    }
-
-    //for (i=0; i<len; i++) {
-    //    dvec2_print (&res[i]);
-    //}
-
-    // Move the original points by the computed force and compute the change
-    // indicator.
-    double change = 0;
-    dvec2 old_p_0 = points[0];
-    dvec2_add_to (&points[0], res[0]);
-    //dvec2_print (&res[0]);
-    for (i=1; i<len; i++) {
-        double old_dist = dvec2_distance (&old_p_0, &points[i]);
-        dvec2_add_to (&points[i], res[i]);
-        //dvec2_print (&res[i]);
-        double new_dist = dvec2_distance (&points[0], &points[i]);
-        change = MAX(change, fabs(old_dist-new_dist));
-    }
-
-    return change*75/alg_st->tgt_radius;
-}
-
 void move_hitbox (struct point_set_mode_t *ps_mode)
 {
     struct gui_state_t *gui_st = global_gui_st;
@@ -377,6 +197,75 @@ void move_hitbox_int (struct point_set_mode_t *ps_mode)
     ps_mode->visible_pts[i] = ptr;
     dvec2_add_to (&hitbox->box.min, gui_st->ptr_delta);
     dvec2_add_to (&hitbox->box.max, gui_st->ptr_delta);
+
+    orientation_validator_move (&ps_mode->validator, ps_mode->visible_pts, i);
+}
+
+// Starts tracking the orientations of the visible points, so while a point is
+// dragged we know if they still have the order type ps_mode->ot.
+void start_point_drag (struct point_set_mode_t *ps_mode)
+{
+    mem_pool_destroy (&ps_mode->validator_pool);
+    chirotope_t *ch = chirotope_new (ps_mode->ot, &ps_mode->validator_pool);
+    orientation_validator_init (&ps_mode->validator, ch, ps_mode->visible_pts,
+                                &ps_mode->validator_pool);
+}
+
+// Cache of visited order types
+//
+// Entries are keyed by (n, ot_id). When the cache is full the least recently
+// used entry is replaced. The cache is small enough that a linear search is
+// faster than anything else we could do.
+struct ot_cache_entry_t* ot_cache_lookup (struct ot_cache_t *cache, int n, uint64_t ot_id)
+{
+    int i;
+    for (i=0; i<OT_CACHE_SIZE; i++) {
+        struct ot_cache_entry_t *entry = &cache->entries[i];
+        if (entry->valid && entry->n == n && entry->ot_id == ot_id) {
+            entry->last_use = ++cache->clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Returns the cache entry for _ot_, creating it if it doesn't exist.
+struct ot_cache_entry_t* ot_cache_get (struct ot_cache_t *cache, order_type_t *ot)
+{
+    struct ot_cache_entry_t *entry = ot_cache_lookup (cache, ot->n, ot->id);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    entry = &cache->entries[0];
+    int i;
+    for (i=1; i<OT_CACHE_SIZE && entry->valid; i++) {
+        if (!cache->entries[i].valid || cache->entries[i].last_use < entry->last_use) {
+            entry = &cache->entries[i];
+        }
+    }
+
+    *entry = (struct ot_cache_entry_t){0};
+    entry->valid = true;
+    entry->n = ot->n;
+    entry->ot_id = ot->id;
+    entry->last_use = ++cache->clock;
+    memcpy (entry->pts, ot->pts, ot->n*sizeof(ivec2));
+    arrange_points_precompute (ot, entry->sort, entry->cvx_hull, &entry->cvx_hull_len);
+    return entry;
+}
+
+// Moves to the order type _id_ of the current n, only reading the database if
+// it's not in the cache.
+void seek_ot (struct point_set_mode_t *ps_mode, uint64_t id)
+{
+    struct ot_cache_entry_t *entry = ot_cache_lookup (&ps_mode->ot_cache, ps_mode->n.i, id);
+    if (entry != NULL) {
+        memcpy (ps_mode->ot->pts, entry->pts, entry->n*sizeof(ivec2));
+        ps_mode->ot->id = id;
+    } else {
+        db_seek (ps_mode->ot, id);
+    }
 }
 
 struct arrange_work_t {
@@ -384,16 +273,20 @@ struct arrange_work_t {
     volatile uint64_t *curr_n;
     uint64_t n; // n at the time the thread was started.
     order_type_t *ot;
+    struct ot_cache_entry_t *entry;
 };
 
 void* arrange_points_work (void *arg)
 {
     struct arrange_work_t *wk = (struct arrange_work_t *)arg;
     struct point_set_mode_t *ps_mode = wk->ps_mode;
+    struct ot_cache_entry_t *entry = wk->entry;
 
     struct arrange_points_state_t alg_st;
     double change;
-    arrange_points_start (&alg_st, wk->ot, ps_mode->arranged_pts);
+    arrange_points_start (&alg_st, wk->ot, ps_mode->arranged_pts,
+                          entry->sort, entry->cvx_hull, entry->cvx_hull_len,
+                          ARRANGE_POINTS_ADAPTIVE);
 
     struct timespec start_time, curr_time;
     clock_gettime (CLOCK_MONOTONIC, &start_time);
@@ -409,8 +302,18 @@ void* arrange_points_work (void *arg)
     //} else if (time_elapsed >= 100) {
     //    printf ("Point autopositioning timed out.\n");
     //}
+    //printf ("Point autopositioning took %"PRIu64" steps (%"PRIu64" rolled back)\n",
+    //        alg_st.steps, alg_st.rollbacks);
+
+    ps_mode->ot_arrangeable = arrange_points_end (&alg_st, ps_mode->arranged_pts, wk->n, 0);
 
-    ps_mode->ot_arrangeable = arrange_points_end (&alg_st, ps_mode->arranged_pts, wk->n);
+    // NOTE: Entries are only replaced by set_ot() after joining this thread,
+    // so entry is still the one for wk->ot.
+    if (wk->n == *(wk->curr_n)) {
+        entry->ot_arrangeable = ps_mode->ot_arrangeable;
+        memcpy (entry->arranged_pts, ps_mode->arranged_pts, wk->n*sizeof(dvec2));
+        entry->arranged = true;
+    }
     mem_pool_end_temporary_memory (global_gui_st->thread_mem_flush);
     pthread_exit(0);
 }
@@ -427,9 +330,27 @@ void set_ot (struct point_set_mode_t *ps_mode)
         ps_mode->visible_pts[i] = pt;
         ps_mode->arranged_pts[i] = pt;
     }
+    ps_mode->validator.violations = 0;
 
     if (global_gui_st->thread != 0) {
         pthread_join (global_gui_st->thread, NULL);
+        global_gui_st->thread = 0;
+    }
+
+    ps_mode->redraw_panel = true;
+    struct ot_cache_entry_t *entry = ot_cache_get (&ps_mode->ot_cache, ps_mode->ot);
+    // NOTE: Order types without a valid precomputed layout still go to the
+    // arrangement thread below, its time limit may allow it to find one.
+    if (!entry->arranged && ps_mode->arranged_db.map != NULL &&
+        arranged_db_get (&ps_mode->arranged_db, ps_mode->ot->id, entry->arranged_pts)) {
+        entry->ot_arrangeable = true;
+        entry->arranged = true;
+    }
+
+    if (entry->arranged) {
+        memcpy (ps_mode->arranged_pts, entry->arranged_pts, n*sizeof(dvec2));
+        ps_mode->ot_arrangeable = entry->ot_arrangeable;
+        return;
     }
 
     struct arrange_work_t *wk =
@@ -438,9 +359,9 @@ void set_ot (struct point_set_mode_t *ps_mode)
     wk->n = ps_mode->n.i;
     wk->curr_n = &ps_mode->n.i;
     wk->ot = order_type_copy (&global_gui_st->thread_pool, ps_mode->ot);
+    wk->entry = entry;
 
     ps_mode->ot_arrangeable = false;
-    ps_mode->redraw_panel = true;
 
     global_gui_st->thread_mem_flush = mem_pool_begin_temporary_memory (&global_gui_st->thread_pool);
     pthread_create (&global_gui_st->thread, NULL, arrange_points_work, wk);
@@ -465,6 +386,7 @@ void set_n (struct point_set_mode_t *st, int n, app_graphics_t *graphics)
 
     st->ot = order_type_new (10, &st->math_memory);
     open_database (n);
+    arranged_db_open (&st->arranged_db, n);
     st->ot->n = n;
     db_next (st->ot);
     set_ot (st);
@@ -820,6 +742,7 @@ void view_arranged_points (struct point_set_mode_t *ps_mode, app_graphics_t *gra
         for (i=0; i<ps_mode->n.i; i++) {
             ps_mode->visible_pts[i] = ps_mode->arranged_pts[i];
         }
+        ps_mode->validator.violations = 0;
         focus_order_type (graphics, ps_mode);
         ps_mode->redraw_canvas = true;
     }
@@ -832,6 +755,7 @@ void view_database_points (struct point_set_mode_t *ps_mode, app_graphics_t *gra
         for (i=0; i<ps_mode->n.i; i++) {
             ps_mode->visible_pts[i] = CAST_DVEC2(ps_mode->ot->pts[i]);
         }
+        ps_mode->validator.violations = 0;
         focus_order_type (graphics, ps_mode);
         ps_mode->redraw_canvas = true;
     }
@@ -949,13 +873,16 @@ bool point_set_mode (struct app_state_t *st, app_graphics_t *graphics)
             {
             layout_box_t *focused_box = gui_st->focus->dest;
             if (ps_mode->focus_list[foc_ot] == focused_box) {
+                uint64_t id = ps_mode->ot->id;
+                uint64_t num_order_types = __g_db_data.num_order_types;
                 if ((XCB_KEY_BUT_MASK_SHIFT & input.modifiers)
                     || input.keycode == KEY_LEFT_ARROW) {
-                    db_prev (ps_mode->ot);
+                    id = id == 0 ? num_order_types-1 : id-1;
 
                 } else {
-                    db_next (ps_mode->ot);
+                    id = id+1 == num_order_types ? 0 : id+1;
                 }
+                seek_ot (ps_mode, id);
                 set_ot (ps_mode);
                 focus_order_type (graphics, ps_mode);
 
@@ -1266,7 +1193,7 @@ bool point_set_mode (struct app_state_t *st, app_graphics_t *graphics)
                     if (val >= __g_db_data.num_order_types) {
                         val = __g_db_data.num_order_types-1;
                     } 
-                    db_seek (ps_mode->ot, val);
+                    seek_ot (ps_mode, val);
                     set_ot (ps_mode);
                     focus_order_type (graphics, ps_mode);
                     break;
@@ -1309,6 +1236,7 @@ bool point_set_mode (struct app_state_t *st, app_graphics_t *graphics)
 
                         if (is_dvec2_in_box (gui_st->click_coord[0], hitbox->box)) {
                             ps_mode->active_hitbox = i;
+                            start_point_drag (ps_mode);
                             move_hitbox_int (ps_mode);
 
                             hit = true;
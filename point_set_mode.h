@@ -26,16 +26,29 @@ typedef enum {
     num_focus_options
 } focus_options_t;
 
-struct arrange_points_state_t {
-    mem_pool_t pool;
-    order_type_t *ot;
-    int *sort;
+// Order types already visited, with everything needed to show them again
+// without reading the database or running the arrangement algorithm. See
+// ot_cache_get().
+#define OT_CACHE_SIZE 64
+struct ot_cache_entry_t {
+    bool valid;
+    int n;
+    uint64_t ot_id;
+    uint64_t last_use;
+
+    ivec2 pts[15];
     int cvx_hull_len;
-    int *cvx_hull;
-    dvec2 centroid;
-    dvec2 *tgt_hull;
-    double tgt_radius;
-    uint64_t steps;
+    int cvx_hull[15];
+    int sort[15*14]; // Output of sort_all_points_p() for each point
+
+    bool arranged; // The fields below are set
+    bool ot_arrangeable;
+    dvec2 arranged_pts[15];
+};
+
+struct ot_cache_t {
+    uint64_t clock;
+    struct ot_cache_entry_t entries[OT_CACHE_SIZE];
 };
 
 struct point_set_mode_t {
@@ -76,9 +89,14 @@ struct point_set_mode_t {
     layout_box_t pts_hitboxes[15];
     int active_hitbox;
     int canvas_state;
+    mem_pool_t validator_pool;
+    orientation_validator_t validator; // Orientations of visible_pts
 
     mem_pool_t math_memory;
     mem_pool_marker_t math_memory_flush;
+
+    struct ot_cache_t ot_cache;
+    arranged_db_t arranged_db; // Closed if there is no file for n
 };
 
 struct app_state_t;
@@ -30,6 +30,7 @@
 #include "geometry_combinatorics.h"
 #include "tree_mode.h"
 #include "grid_mode.h"
+#include "arrange_points.h"
 #include "point_set_mode.h"
 #include "config.c"
 #include "app_api.h"
@@ -43,6 +44,7 @@
 #include "order_types.c"
 #include "tree_mode.c"
 #include "grid_mode.c"
+#include "arrange_points.c"
 #include "point_set_mode.c"
 #include "download_screen.c"
 
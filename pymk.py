@@ -47,7 +47,7 @@ def point_set_viewer ():
     ex (f'gcc {FLAGS} -o bin/point-set-viewer point_set_viewer.c {PANGO_FLAGS} {DEP_FLAGS}')
 
 def search ():
-    ex (f'gcc {FLAGS} -o bin/search search.c -lm')
+    ex (f'gcc {FLAGS} -o bin/search search.c -lm -lpthread')
 
 def render_seq ():
     ex (f'gcc {FLAGS} -o bin/render_seq render_seq.c -lcairo -lm')
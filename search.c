@@ -8,7 +8,9 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 //#define NDEBUG
 #include <assert.h>
 #include <errno.h>
@@ -19,9 +21,12 @@
 #include "order_types.h"
 #include "geometry_combinatorics.h"
 
+#include "arrange_points.h"
+
 #define SEQUENCE_STORE_IMPL
 #include "sequence_store.h"
 #include "order_types.c"
+#include "arrange_points.c"
 
 // Function to define functions that read binary arrays of elements of type
 // _type_ to files.
@@ -72,6 +77,7 @@ void funcname (char *filename, uint64_t *arr, uint64_t count) \
     }                                                         \
 }
 templ_write_bin_file(write_uint64_to_uint32_bin_file, uint32_t)
+templ_write_bin_file(write_uint64_to_uint8_bin_file, uint8_t)
 
 // TODO: Add timing:
 //   - Compute ETA.
@@ -107,65 +113,265 @@ void progress_bar (float val, float total)
     }
 }
 
-#if 1
+// Checkpoints
+//
+// Long sweeps over a database periodically save their state to a file in
+// .cache/, so they can be resumed after being interrupted, even in a different
+// machine. A checkpoint stores the id of the first order type that was not
+// processed, the aggregates computed so far, and optionally an array with a
+// result for each order type:
+//
+//   struct checkpoint_header_t
+//   uint8_t aggregates[aggregates_size]
+//   uint8_t results[next_id][result_size]
+//
+// Files are written to a temporary file and then renamed, so an interruption
+// while writing leaves the previous checkpoint intact.
+//
+// NOTE: Data is stored as is, checkpoints can only be moved between machines
+// with the same endianness.
+#define CHECKPOINT_MAGIC 0x54504b43 // "CKPT"
+#define CHECKPOINT_INTERVAL_MS (5*60*1000)
+
+struct checkpoint_header_t {
+    uint32_t magic;
+    uint32_t n;
+    uint64_t num_order_types;
+    uint64_t next_id;
+    uint32_t aggregates_size;
+    uint32_t result_size;
+};
+
+typedef struct {
+    char path[100];
+    int n;
+    uint64_t next_id;
+
+    // Set by the caller before checkpoint_load(). The content of these is
+    // what gets saved.
+    void *aggregates;
+    uint32_t aggregates_size;
+    void *results; // Can be NULL
+    uint32_t result_size;
+
+    struct timespec last_write;
+} checkpoint_t;
+
+void checkpoint_init (checkpoint_t *ckpt, int n, char *name,
+                      void *aggregates, uint32_t aggregates_size,
+                      void *results, uint32_t result_size)
+{
+    *ckpt = (checkpoint_t){0};
+    snprintf (ckpt->path, ARRAY_SIZE(ckpt->path), ".cache/n_%d_%s.ckpt", n, name);
+    ckpt->n = n;
+    ckpt->aggregates = aggregates;
+    ckpt->aggregates_size = aggregates_size;
+    ckpt->results = results;
+    ckpt->result_size = results != NULL ? result_size : 0;
+    clock_gettime (CLOCK_MONOTONIC, &ckpt->last_write);
+}
+
+bool checkpoint_read_full (int file, void *data, uint64_t size)
+{
+    uint8_t *pos = data;
+    while (size > 0) {
+        ssize_t status = read (file, pos, size);
+        if (status <= 0) {
+            return false;
+        }
+        pos += status;
+        size -= status;
+    }
+    return true;
+}
+
+bool checkpoint_write_full (int file, void *data, uint64_t size)
+{
+    uint8_t *pos = data;
+    while (size > 0) {
+        ssize_t status = write (file, pos, size);
+        if (status == -1) {
+            return false;
+        }
+        pos += status;
+        size -= status;
+    }
+    return true;
+}
+
+// Loads the checkpoint into the aggregates and results of _ckpt_. Returns
+// false if there is no checkpoint or it doesn't match what _ckpt_ expects, in
+// that case the computation starts from the beginning.
+bool checkpoint_load (checkpoint_t *ckpt)
+{
+    int file = open (ckpt->path, O_RDONLY);
+    if (file == -1) {
+        return false;
+    }
+
+    bool success = false;
+    struct checkpoint_header_t header;
+    if (checkpoint_read_full (file, &header, sizeof(header))) {
+        if (header.magic != CHECKPOINT_MAGIC || header.n != ckpt->n ||
+            header.num_order_types != db_num_order_types (ckpt->n) ||
+            header.next_id > header.num_order_types ||
+            header.aggregates_size != ckpt->aggregates_size ||
+            header.result_size != ckpt->result_size) {
+            printf ("Ignoring incompatible checkpoint %s\n", ckpt->path);
+
+        } else if (checkpoint_read_full (file, ckpt->aggregates, header.aggregates_size) &&
+                   checkpoint_read_full (file, ckpt->results, header.next_id*header.result_size)) {
+            ckpt->next_id = header.next_id;
+            success = true;
+            printf ("Resuming from %s at order type %"PRIu64"\n", ckpt->path, ckpt->next_id);
+
+        } else {
+            printf ("Could not read checkpoint %s\n", ckpt->path);
+        }
+    }
+    close (file);
+    return success;
+}
+
+// Saves the state of a computation where order types before _next_id_ have
+// been processed.
+bool checkpoint_write (checkpoint_t *ckpt, uint64_t next_id)
+{
+    ckpt->next_id = next_id;
+    clock_gettime (CLOCK_MONOTONIC, &ckpt->last_write);
+
+    char tmp_path[ARRAY_SIZE(ckpt->path)+4];
+    snprintf (tmp_path, ARRAY_SIZE(tmp_path), "%s.tmp", ckpt->path);
+    int file = open (tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (file == -1) {
+        printf ("Could not create %s: %s\n", tmp_path, strerror(errno));
+        return false;
+    }
+
+    struct checkpoint_header_t header = {0};
+    header.magic = CHECKPOINT_MAGIC;
+    header.n = ckpt->n;
+    header.num_order_types = db_num_order_types (ckpt->n);
+    header.next_id = next_id;
+    header.aggregates_size = ckpt->aggregates_size;
+    header.result_size = ckpt->result_size;
+
+    bool success = checkpoint_write_full (file, &header, sizeof(header)) &&
+        checkpoint_write_full (file, ckpt->aggregates, ckpt->aggregates_size) &&
+        checkpoint_write_full (file, ckpt->results, next_id*ckpt->result_size) &&
+        fsync (file) == 0;
+    close (file);
+
+    if (!success || rename (tmp_path, ckpt->path) == -1) {
+        printf ("Could not write checkpoint %s: %s\n", ckpt->path, strerror(errno));
+        unlink (tmp_path);
+        return false;
+    }
+    return true;
+}
+
+// Calls checkpoint_write() if enough time passed since the last write.
+void checkpoint_maybe_write (checkpoint_t *ckpt, uint64_t next_id)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    if (time_elapsed_in_ms (&ckpt->last_write, &now) >= CHECKPOINT_INTERVAL_MS) {
+        checkpoint_write (ckpt, next_id);
+    }
+}
+
+// Called when the computation finished and its output was written.
+void checkpoint_remove (checkpoint_t *ckpt)
+{
+    unlink (ckpt->path);
+}
+
+#if defined(THRACKLE_SEARCH_BITSET)
+#define single_thrackle_func single_thrackle_bitset
+#elif 1
 #define single_thrackle_func single_thrackle
 #else
 #define single_thrackle_func single_thrackle_slow
 #endif
-void get_thrackle_for_each_ot (int n, int k)
+struct thrackle_for_each_ot_aggregates_t {
+    float average;
+    int searches;
+};
+
+// Finds a thrackle of size _k_ for each order type of size _n_ and prints the
+// ids of order types that don't have one. If _resume_ is true it continues
+// from the last checkpoint.
+void get_thrackle_for_each_ot (int n, int k, bool resume)
 {
     uint64_t id = 0;
     order_type_t *ot = order_type_new (n, NULL);
     int *curr_set = malloc (sizeof(int)*k);
-
-    triangle_set_t *triangle_set = malloc (triangle_set_size (k));
-    triangle_set->k = k;
+    thrackle_compat_t compat;
 
     open_database (n);
-    db_seek (ot, id);
 
-    int total_triangles = binomial (n, 3);
-    float average = 0;
-    int nodes = 0, searches = 0;
-    srand (time(NULL));
-    int rand_arr[total_triangles];
-    init_random_array (rand_arr, total_triangles);
-    bool found = single_thrackle_func (n, k, ot, curr_set, &nodes, rand_arr);
-
-    bool print_all = false;
-    while (!db_is_eof ()) {
-        if (print_all) {
-            printf ("%ld: ", id);
-            if (found) {
-                array_print (curr_set, k);
+    struct thrackle_for_each_ot_aggregates_t agg = {0};
+    char ckpt_name[40];
+    snprintf (ckpt_name, ARRAY_SIZE(ckpt_name), "k_%d_thrackle_for_each_ot", k);
+    checkpoint_t ckpt;
+    checkpoint_init (&ckpt, n, ckpt_name, &agg, sizeof(agg), NULL, 0);
+    if (resume && checkpoint_load (&ckpt)) {
+        id = ckpt.next_id;
+    }
+
+    if (id < __g_db_data.num_order_types) {
+        db_seek (ot, id);
+        db_prefetch_start (0);
+
+        int total_triangles = binomial (n, 3);
+        int nodes = 0;
+        srand (time(NULL));
+        int rand_arr[total_triangles];
+        init_random_array (rand_arr, total_triangles);
+        bool found = single_thrackle_func (n, k, ot, curr_set, &nodes, rand_arr);
+
+        bool print_all = false;
+        while (!db_is_eof ()) {
+            if (print_all) {
+                printf ("%ld: ", id);
+                if (found) {
+                    array_print (curr_set, k);
+                } else {
+                    printf ("None\n");
+                }
+
+                //printf ("%ld: %lu\n", id, subset_it_id_for_idx (total_triangles, curr_set, k));
             } else {
-                printf ("None\n");
+                if (!found) {
+                    printf ("%ld\n", id);
+                }
+                progress_bar (id, __g_db_data.num_order_types);
             }
 
-            //printf ("%ld: %lu\n", id, subset_it_id_for_idx (total_triangles, curr_set, k));
-        } else {
-            if (!found) {
-                printf ("%ld\n", id);
-            }
-            progress_bar (id, __g_db_data.num_order_types);
-        }
+            // NOTE: Output is flushed so it's not ahead of the checkpoint.
+            fflush (stdout);
+            checkpoint_maybe_write (&ckpt, id+1);
 
-        db_next (ot);
-        triangle_set_from_ids (ot, n, curr_set, k, triangle_set);
-
-        found = false;
-        if (!is_thrackle(triangle_set)) {
-            fisher_yates_shuffle (rand_arr, total_triangles);
-            nodes = 0;
-            found = single_thrackle_func (n, k, ot, curr_set, &nodes, rand_arr);
-            average += nodes;
-            searches++;
-        } else {
-            found = true;
+            db_next (ot);
+            thrackle_compat_from_ot (ot, &compat);
+
+            found = false;
+            if (!is_thrackle_ids (&compat, curr_set, k)) {
+                fisher_yates_shuffle (rand_arr, total_triangles);
+                nodes = 0;
+                found = single_thrackle_func (n, k, ot, curr_set, &nodes, rand_arr);
+                agg.average += nodes;
+                agg.searches++;
+            } else {
+                found = true;
+            }
+            id++;
         }
-        id++;
+        db_prefetch_stop ();
     }
-    printf ("Searches: %d, Average nodes: %f\n", searches, average/searches);
+    checkpoint_remove (&ckpt);
+    printf ("Searches: %d, Average nodes: %f\n", agg.searches, agg.average/agg.searches);
+    free (curr_set);
 }
 
 enum tr_order_t {
@@ -225,11 +431,65 @@ enum format_thrackle_count_t {
     STATS_PRINT              = 1L<<0,
     COUNT_PER_THRACKLE_PRINT = 1L<<1,
     COUNT_PER_THRACKLE_FILE  = 1L<<2,
-    FIRST_THRACKLE           = 1L<<3
+    FIRST_THRACKLE           = 1L<<3,
+    RESUME                   = 1L<<4, // Continue from the last checkpoint
+    UNLABELED                = 1L<<5, // Search up to automorphisms of each order type
+    INCREMENTAL              = 1L<<6  // Reuse the counts of the previous order type
 };
 
+struct search_full_tree_aggregates_t {
+    float average;
+    int max_size;
+    uint64_t max_count;
+    uint64_t labeled;
+    uint64_t unlabeled;
+};
+
+// Searches the thrackles of _ot_ and returns the number of labeled thrackles
+// of each size, the array is allocated in _pool_. With UNLABELED in _fmt_ the
+// tree is pruned using the automorphism group of _ot_, then at the maximum
+// size seq->nodes_per_len has the unlabeled count and the returned array the
+// labeled one, smaller sizes are not meaningful. Without it both are the same.
+uint64_t* thrackle_search_tree_fmt (int n, order_type_t *ot, struct sequence_store_t *seq,
+                                    enum format_thrackle_count_t fmt, mem_pool_t *pool)
+{
+    uint64_t *labeled = NULL;
+    if (fmt & UNLABELED) {
+        int max_len = n <= 9 ? thrackle_size (n) : thrackle_size_upper_bound (n);
+        labeled = mem_pool_push_size_full (pool, (max_len+1)*sizeof(uint64_t), POOL_ZERO_INIT, NULL, NULL);
+
+        triangle_group_t grp;
+        automorphism_triangle_group (ot, &grp, pool);
+        thrackle_search_tree_canonical (n, ot, &grp, seq, labeled);
+        seq_tree_end (seq);
+    } else {
+        thrackle_search_tree (n, ot, seq);
+        seq_tree_end (seq);
+        labeled = seq->nodes_per_len;
+    }
+    return labeled;
+}
+
+// With INCREMENTAL, order types whose compatibility matrix differs in more
+// than this number of pairs from the previous one are searched from scratch.
+// Measured on n=8 and n=9, updating is still faster than searching when 1/8
+// of the pairs of triangles changed.
+#define INCREMENTAL_MAX_CHANGED_PAIRS(n) (binomial(binomial(n,3),2)/8)
+
 // Counts how many thrackles each order type has. _fmt_ chooses how to output
-// the result.
+// the result. With UNLABELED thrackles are also counted up to automorphisms
+// of the order type, and both counts are printed.
+//
+// With INCREMENTAL the chirotope of each order type is compared against the
+// previous one, if no pair of triangles changed compatibility the previous
+// counts are reused, if few did they are updated with
+// thrackle_count_update(), otherwise a full search is done. Results are the
+// same as without it, STATS_PRINT also prints how many order types went
+// through each case, and COUNT_PER_THRACKLE_PRINT adds a column with the
+// number of pairs that changed compatibility, or -1 if it was searched.
+//
+// NOTE: INCREMENTAL is ignored with FIRST_THRACKLE and UNLABELED. After
+// RESUME the first order type is always searched.
 void search_full_tree_all_ot (int n, enum format_thrackle_count_t fmt)
 {
     assert(n <= 9);
@@ -238,38 +498,129 @@ void search_full_tree_all_ot (int n, enum format_thrackle_count_t fmt)
     order_type_t *ot = order_type_new (n, NULL);
 
     open_database (n);
-    db_seek (ot, id);
 
-    float average = 0;
-    int max_size = 0;
-    int max_count = 0;
+    struct search_full_tree_aggregates_t agg = {0};
 
     uint64_t *count = NULL;
     if (fmt & COUNT_PER_THRACKLE_FILE) {
         count = mem_pool_push_array (&pool, db_num_order_types (n), uint64_t);
     }
 
-    while (!db_is_eof ()) {
+    checkpoint_t ckpt;
+    char *ckpt_name;
+    if (fmt & UNLABELED) {
+        ckpt_name = fmt & FIRST_THRACKLE ? "full_tree_unlabeled_first_thrackle" : "full_tree_unlabeled";
+    } else {
+        ckpt_name = fmt & FIRST_THRACKLE ? "full_tree_first_thrackle" : "full_tree";
+    }
+    checkpoint_init (&ckpt, n, ckpt_name, &agg, sizeof(agg), count, sizeof(uint64_t));
+    if (fmt & RESUME && checkpoint_load (&ckpt)) {
+        id = ckpt.next_id;
+    }
+
+    if (id < db_num_order_types (n)) {
+        db_seek (ot, id);
+    }
+
+    if (fmt & (FIRST_THRACKLE|UNLABELED)) {
+        fmt &= ~INCREMENTAL;
+    }
+
+    // NOTE: Incremental state, compat[curr] are the rows of the current order
+    // type and compat[1-curr] the ones of the previous one.
+    int k = thrackle_size (n);
+    uint64_t inc_count[k+1];
+    thrackle_compat_t compat[2];
+    int curr = 0;
+    chirotope_t *prev_ch = chirotope_alloc (n, &pool);
+    bool have_prev = false;
+    uint64_t num_reused = 0, num_updated = 0, num_searched = 0;
+
+    while (id < db_num_order_types (n)) {
         mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&pool);
-        struct sequence_store_t seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
-        if (fmt & FIRST_THRACKLE) {
-            seq_set_seq_number (&seq, 1);
-            seq_set_seq_len (&seq, thrackle_size(n));
+
+        int max_len;
+        uint64_t num_nodes, max_count, labeled_max_count;
+        int changed_pairs = -1;
+        if (fmt & INCREMENTAL) {
+            chirotope_t *ch = chirotope_new (ot, &pool);
+            thrackle_compat_from_ot (ot, &compat[curr]);
+            if (have_prev) {
+                tr_bitset_t affected;
+                thrackle_compat_affected_rows (prev_ch, ch, &affected);
+                changed_pairs = thrackle_count_update (n, k, compat[1-curr].rows, compat[curr].rows,
+                                                       &affected, INCREMENTAL_MAX_CHANGED_PAIRS(n),
+                                                       inc_count);
+                if (changed_pairs > INCREMENTAL_MAX_CHANGED_PAIRS(n)) {
+                    changed_pairs = -1;
+                }
+            }
+
+            if (changed_pairs == -1) {
+                struct sequence_store_t seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
+                thrackle_search_tree (n, ot, &seq);
+                seq_tree_end (&seq);
+
+                int s;
+                for (s=0; s<=k; s++) {
+                    inc_count[s] = s <= seq.final_max_len ? seq.nodes_per_len[s] : 0;
+                }
+                num_searched++;
+            } else if (changed_pairs == 0) {
+                num_reused++;
+            } else {
+                num_updated++;
+            }
+
+            max_len = 0;
+            num_nodes = 0;
+            int s;
+            for (s=0; s<=k; s++) {
+                if (inc_count[s] != 0) {
+                    max_len = s;
+                }
+                num_nodes += inc_count[s];
+            }
+            max_count = inc_count[max_len];
+            labeled_max_count = max_count;
+
+            memcpy (prev_ch->words, ch->words, ch->num_words*sizeof(uint64_t));
+            curr = 1-curr;
+            have_prev = true;
+
+        } else {
+            struct sequence_store_t seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
+            if (fmt & FIRST_THRACKLE) {
+                seq_set_seq_number (&seq, 1);
+                seq_set_seq_len (&seq, thrackle_size(n));
+            }
+            uint64_t *labeled = thrackle_search_tree_fmt (n, ot, &seq, fmt, &pool);
+
+            max_len = seq.final_max_len;
+            num_nodes = seq.num_nodes;
+            max_count = seq.nodes_per_len[max_len];
+            labeled_max_count = labeled[max_len];
         }
-        thrackle_search_tree (n, ot, &seq);
-        seq_tree_end (&seq);
 
         if (fmt & COUNT_PER_THRACKLE_PRINT) {
-            printf ("%"PRIu64" %"PRIu64"\n", id, seq.nodes_per_len[seq.final_max_len]);
+            if (fmt & UNLABELED) {
+                printf ("%"PRIu64" %"PRIu64" %"PRIu64"\n", id, labeled_max_count, max_count);
+            } else if (fmt & INCREMENTAL) {
+                printf ("%"PRIu64" %"PRIu64" %d\n", id, max_count, changed_pairs);
+            } else {
+                printf ("%"PRIu64" %"PRIu64"\n", id, max_count);
+            }
         }
 
         if (fmt & COUNT_PER_THRACKLE_FILE) {
-            count[id] = seq.nodes_per_len[seq.final_max_len];
+            count[id] = max_count;
         }
 
-        average += seq.num_nodes;
-        max_size = MAX(seq.final_max_len, max_size);
-        max_count = MAX(seq.nodes_per_len[seq.final_max_len], max_count);
+        agg.labeled += labeled_max_count;
+        agg.unlabeled += max_count;
+        agg.average += num_nodes;
+        agg.max_size = MAX(max_len, agg.max_size);
+        agg.max_count = MAX(max_count, agg.max_count);
 
         if (!(fmt & COUNT_PER_THRACKLE_PRINT)) {
             progress_bar (id, db_num_order_types (n));
@@ -277,19 +628,382 @@ void search_full_tree_all_ot (int n, enum format_thrackle_count_t fmt)
         db_next (ot);
         id++;
         mem_pool_end_temporary_memory (mrk);
+        checkpoint_maybe_write (&ckpt, id);
     }
 
     if (fmt & COUNT_PER_THRACKLE_FILE) {
-        if (max_count <= UINT32_MAX) {
-            char filename[40];
-            snprintf (filename, ARRAY_SIZE(filename), ".cache/n_%d_thrackle_count.bin", n);
+        if (agg.max_count <= UINT32_MAX) {
+            char filename[50];
+            snprintf (filename, ARRAY_SIZE(filename), ".cache/n_%d_thrackle_count%s.bin",
+                      n, fmt & UNLABELED ? "_unlabeled" : "");
             write_uint64_to_uint32_bin_file (filename, count, db_num_order_types(n));
         }
     }
+    checkpoint_remove (&ckpt);
 
     if (fmt & STATS_PRINT) {
-        printf ("Max Size: %d, Average nodes: %f\n", max_size, average/(id));
+        printf ("Max Size: %d, Average nodes: %f\n", agg.max_size, agg.average/(id));
+        if (fmt & UNLABELED) {
+            printf ("Labeled: %"PRIu64", Unlabeled: %"PRIu64"\n", agg.labeled, agg.unlabeled);
+        }
+        if (fmt & INCREMENTAL) {
+            printf ("Reused: %"PRIu64", Updated: %"PRIu64", Searched: %"PRIu64"\n",
+                    num_reused, num_updated, num_searched);
+        }
+    }
+    mem_pool_destroy (&pool);
+}
+
+struct search_full_tree_worker_t {
+    mem_pool_t pool;
+    double average;
+    int max_size;
+    uint64_t max_count;
+    uint64_t labeled;
+    uint64_t unlabeled;
+};
+
+struct search_full_tree_shared_t {
+    enum format_thrackle_count_t fmt;
+    uint64_t *count;
+    uint64_t *labeled_count; // Only used with UNLABELED and COUNT_PER_THRACKLE_PRINT
+    struct search_full_tree_worker_t *workers;
+};
+
+OT_DB_FOR_CB(search_full_tree_ot)
+{
+    struct search_full_tree_shared_t *sh = (struct search_full_tree_shared_t*)closure;
+    struct search_full_tree_worker_t *wk = &sh->workers[thread_id];
+    int n = ot->n;
+
+    mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&wk->pool);
+    struct sequence_store_t seq = new_sequence_store_opts (NULL, &wk->pool, SEQ_DRY_RUN);
+    if (sh->fmt & FIRST_THRACKLE) {
+        seq_set_seq_number (&seq, 1);
+        seq_set_seq_len (&seq, thrackle_size(n));
+    }
+    uint64_t *labeled = thrackle_search_tree_fmt (n, ot, &seq, sh->fmt, &wk->pool);
+
+    if (sh->count != NULL) {
+        sh->count[ot->id] = seq.nodes_per_len[seq.final_max_len];
     }
+    if (sh->labeled_count != NULL) {
+        sh->labeled_count[ot->id] = labeled[seq.final_max_len];
+    }
+
+    wk->labeled += labeled[seq.final_max_len];
+    wk->unlabeled += seq.nodes_per_len[seq.final_max_len];
+    wk->average += seq.num_nodes;
+    wk->max_size = MAX(seq.final_max_len, wk->max_size);
+    wk->max_count = MAX(seq.nodes_per_len[seq.final_max_len], wk->max_count);
+    mem_pool_end_temporary_memory (mrk);
+}
+
+// Same as search_full_tree_all_ot() but order types are processed by
+// _num_threads_ threads using ot_db_parallel_start(). If _num_threads_ is 0
+// the number of online processors is used.
+//
+// NOTE: When using COUNT_PER_THRACKLE_PRINT the output is printed after all
+// order types have been processed, so it's still sorted by id.
+void search_full_tree_all_ot_parallel (int n, enum format_thrackle_count_t fmt, int num_threads)
+{
+    assert(n <= 11);
+    mem_pool_t pool = {0};
+
+    if (num_threads <= 0) {
+        num_threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+
+    uint64_t num_order_types = db_num_order_types (n);
+    struct search_full_tree_shared_t sh = {0};
+    sh.fmt = fmt;
+    if (fmt & (COUNT_PER_THRACKLE_PRINT|COUNT_PER_THRACKLE_FILE)) {
+        sh.count = mem_pool_push_array (&pool, num_order_types, uint64_t);
+    }
+    if (fmt & UNLABELED && fmt & COUNT_PER_THRACKLE_PRINT) {
+        sh.labeled_count = mem_pool_push_array (&pool, num_order_types, uint64_t);
+    }
+    sh.workers = mem_pool_push_array (&pool, num_threads, struct search_full_tree_worker_t);
+    int i;
+    for (i=0; i<num_threads; i++) {
+        sh.workers[i] = (struct search_full_tree_worker_t){0};
+    }
+
+    ot_db_parallel_t par = {0};
+    ot_db_parallel_start (&par, n, num_threads, search_full_tree_ot, &sh);
+
+    if (!(fmt & COUNT_PER_THRACKLE_PRINT)) {
+        uint64_t processed;
+        while ((processed = ot_db_parallel_processed (&par)) < num_order_types) {
+            progress_bar (processed, num_order_types);
+            usleep (100000);
+        }
+        progress_bar (num_order_types, num_order_types);
+    }
+    ot_db_parallel_wait (&par);
+
+    double average = 0;
+    int max_size = 0;
+    uint64_t max_count = 0;
+    uint64_t labeled = 0, unlabeled = 0;
+    for (i=0; i<num_threads; i++) {
+        labeled += sh.workers[i].labeled;
+        unlabeled += sh.workers[i].unlabeled;
+        average += sh.workers[i].average;
+        max_size = MAX (sh.workers[i].max_size, max_size);
+        max_count = MAX (sh.workers[i].max_count, max_count);
+        mem_pool_destroy (&sh.workers[i].pool);
+    }
+
+    if (fmt & COUNT_PER_THRACKLE_PRINT) {
+        uint64_t id;
+        for (id=0; id<num_order_types; id++) {
+            if (fmt & UNLABELED) {
+                printf ("%"PRIu64" %"PRIu64" %"PRIu64"\n", id, sh.labeled_count[id], sh.count[id]);
+            } else {
+                printf ("%"PRIu64" %"PRIu64"\n", id, sh.count[id]);
+            }
+        }
+    }
+
+    if (fmt & COUNT_PER_THRACKLE_FILE) {
+        if (max_count <= UINT32_MAX) {
+            char filename[50];
+            snprintf (filename, ARRAY_SIZE(filename), ".cache/n_%d_thrackle_count%s.bin",
+                      n, fmt & UNLABELED ? "_unlabeled" : "");
+            write_uint64_to_uint32_bin_file (filename, sh.count, num_order_types);
+        }
+    }
+
+    if (fmt & STATS_PRINT) {
+        printf ("Max Size: %d, Average nodes: %f\n", max_size, average/num_order_types);
+        if (fmt & UNLABELED) {
+            printf ("Labeled: %"PRIu64", Unlabeled: %"PRIu64"\n", labeled, unlabeled);
+        }
+    }
+    mem_pool_destroy (&pool);
+}
+
+// Sharded search using processes
+//
+// The range of order type ids is split in one contiguous shard for each
+// worker process. Workers are forked, so a crash in one of them doesn't take
+// down the others, and report through a table in shared memory:
+//
+//   struct shard_table_t
+//   struct shard_status_t shards[num_shards]
+//   uint64_t results[num_order_types]
+//
+// When all workers finish the parent aggregates the results and writes them
+// to the .cache/ directory.
+//
+// NOTE: SHARD_JOB_FIRST_THRACKLE stores the size of the largest thrackle
+// found by branch and bound, stopping at thrackle_size(n), into
+// n_<n>_first_thrackle.bin. This is not what FIRST_THRACKLE does in
+// search_full_tree_all_ot(), there the number of thrackles of the largest
+// size reached by the tree search is stored, so the files aren't comparable.
+enum shard_job_t {
+    SHARD_JOB_THRACKLE_COUNT,    // Number of maximum thrackles
+    SHARD_JOB_FIRST_THRACKLE,    // Size of the first thrackle found, up to thrackle_size(n)
+    SHARD_JOB_MAX_THRACKLE_SIZE  // Size of the largest thrackle
+};
+
+// NOTE: Each field is only written by the worker of the shard.
+struct shard_status_t {
+    uint64_t start;
+    uint64_t end;
+    volatile uint64_t processed;
+    volatile bool done;
+
+    double total_nodes;
+    int max_size;
+    uint64_t max_count;
+};
+
+struct shard_table_t {
+    int n;
+    enum shard_job_t job;
+    int num_shards;
+    uint64_t num_order_types;
+    struct shard_status_t *shards;
+    uint64_t *results;
+};
+
+char* shard_job_filename (enum shard_job_t job)
+{
+    switch (job) {
+        case SHARD_JOB_THRACKLE_COUNT: return "thrackle_count";
+        case SHARD_JOB_FIRST_THRACKLE: return "first_thrackle";
+        case SHARD_JOB_MAX_THRACKLE_SIZE: return "max_thrackle_size";
+        default: invalid_code_path;
+    }
+    return NULL;
+}
+
+void shard_worker (struct shard_table_t *tbl, int shard_id)
+{
+    struct shard_status_t *shard = &tbl->shards[shard_id];
+    int n = tbl->n;
+    mem_pool_t pool = {0};
+    order_type_t *ot = order_type_new (n, &pool);
+
+    ot_db_stream_t st = {0};
+    if (!ot_db_stream_open (&st, n)) {
+        exit (1);
+    }
+    ot_db_stream_range (&st, shard->start, shard->end);
+
+    int th[thrackle_size_upper_bound (n)];
+    while (ot_db_stream_next (&st, ot)) {
+        if (tbl->job == SHARD_JOB_THRACKLE_COUNT) {
+            mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&pool);
+            struct sequence_store_t seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
+            thrackle_search_tree (n, ot, &seq);
+            seq_tree_end (&seq);
+
+            uint64_t count = seq.nodes_per_len[seq.final_max_len];
+            tbl->results[ot->id] = count;
+            shard->total_nodes += seq.num_nodes;
+            shard->max_size = MAX(seq.final_max_len, shard->max_size);
+            shard->max_count = MAX(count, shard->max_count);
+            mem_pool_end_temporary_memory (mrk);
+        } else {
+            // NOTE: These jobs only need a size, branch and bound visits a
+            // small fraction of the nodes of the full tree.
+            int stop_size = thrackle_size_upper_bound (n);
+            if (tbl->job == SHARD_JOB_FIRST_THRACKLE && thrackle_size (n) > 0) {
+                stop_size = thrackle_size (n);
+            }
+            uint64_t nodes;
+            int size = thrackle_branch_and_bound (n, ot, 1, stop_size, th, &nodes);
+            tbl->results[ot->id] = size;
+            shard->total_nodes += nodes;
+            shard->max_size = MAX(size, shard->max_size);
+        }
+        shard->processed++;
+    }
+
+    ot_db_stream_close (&st);
+    mem_pool_destroy (&pool);
+    shard->done = true;
+}
+
+// Runs _job_ on all order types of size _n_ using _num_procs_ worker
+// processes, or one per processor if it's 0. Returns false if any of the
+// workers failed, in that case nothing is written.
+bool search_sharded (int n, enum shard_job_t job, int num_procs, enum format_thrackle_count_t fmt)
+{
+    assert(n <= 11);
+    if (num_procs <= 0) {
+        num_procs = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+    }
+
+    struct shard_table_t tbl = {0};
+    tbl.n = n;
+    tbl.job = job;
+    tbl.num_shards = num_procs;
+    tbl.num_order_types = db_num_order_types (n);
+
+    // NOTE: An anonymous shared mapping is inherited by forked workers, and
+    // unlike shm_open() nothing is left behind if we crash.
+    uint64_t size = num_procs*sizeof(struct shard_status_t) + tbl.num_order_types*sizeof(uint64_t);
+    void *shared = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        printf ("Could not allocate shared memory: %s\n", strerror(errno));
+        return false;
+    }
+    tbl.shards = shared;
+    tbl.results = (uint64_t*)(tbl.shards + num_procs);
+
+    pid_t pids[num_procs];
+    int i;
+    for (i=0; i<num_procs; i++) {
+        struct shard_status_t *shard = &tbl.shards[i];
+        shard->start = tbl.num_order_types*i/num_procs;
+        shard->end = tbl.num_order_types*(i+1)/num_procs;
+
+        // NOTE: Flush so buffered output isn't duplicated by the child.
+        fflush (stdout);
+        pids[i] = fork ();
+        if (pids[i] == 0) {
+            shard_worker (&tbl, i);
+            _exit (0);
+        } else if (pids[i] == -1) {
+            printf ("Could not create worker process: %s\n", strerror(errno));
+        }
+    }
+
+    int running = 0;
+    for (i=0; i<num_procs; i++) {
+        if (pids[i] > 0) running++;
+    }
+
+    bool success = running == num_procs;
+    while (running > 0) {
+        int status;
+        pid_t pid;
+        while ((pid = waitpid (-1, &status, WNOHANG)) > 0) {
+            for (i=0; i<num_procs; i++) {
+                if (pids[i] == pid) break;
+            }
+            if (i == num_procs) {
+                // NOTE: Not one of our workers, a child created elsewhere.
+                continue;
+            }
+
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !tbl.shards[i].done) {
+                printf ("Worker for order types [%"PRIu64", %"PRIu64") failed.\n",
+                        tbl.shards[i].start, tbl.shards[i].end);
+                success = false;
+            }
+            running--;
+        }
+
+        if (running > 0) {
+            uint64_t processed = 0;
+            for (i=0; i<num_procs; i++) {
+                processed += tbl.shards[i].processed;
+            }
+            progress_bar (processed, tbl.num_order_types);
+            usleep (100000);
+        }
+    }
+    progress_bar (tbl.num_order_types, tbl.num_order_types);
+
+    if (success) {
+        double total_nodes = 0;
+        int max_size = 0;
+        uint64_t max_count = 0;
+        for (i=0; i<num_procs; i++) {
+            total_nodes += tbl.shards[i].total_nodes;
+            max_size = MAX (tbl.shards[i].max_size, max_size);
+            max_count = MAX (tbl.shards[i].max_count, max_count);
+        }
+
+        if (fmt & COUNT_PER_THRACKLE_PRINT) {
+            uint64_t id;
+            for (id=0; id<tbl.num_order_types; id++) {
+                printf ("%"PRIu64" %"PRIu64"\n", id, tbl.results[id]);
+            }
+        }
+
+        if (fmt & COUNT_PER_THRACKLE_FILE) {
+            char filename[60];
+            snprintf (filename, ARRAY_SIZE(filename), ".cache/n_%d_%s.bin", n, shard_job_filename (job));
+            if (job != SHARD_JOB_THRACKLE_COUNT) {
+                write_uint64_to_uint8_bin_file (filename, tbl.results, tbl.num_order_types);
+            } else if (max_count <= UINT32_MAX) {
+                write_uint64_to_uint32_bin_file (filename, tbl.results, tbl.num_order_types);
+            }
+        }
+
+        if (fmt & STATS_PRINT) {
+            printf ("Max Size: %d, Average nodes: %f\n", max_size, total_nodes/tbl.num_order_types);
+        }
+    }
+
+    munmap (shared, size);
+    return success;
 }
 
 uint32_t* load_uint32_from_text_file (char *filename, int *count)
@@ -330,8 +1044,7 @@ uint32_t* load_uint32_from_text_file (char *filename, int *count)
 
 void max_thrackle_size_ot_file (int n, char *filename)
 {
-    assert(n <= 10);
-    mem_pool_t pool = {0};
+    assert(n <= 11);
     order_type_t *ot = order_type_new (n, NULL);
 
     int num_ot_ids = 0;
@@ -343,16 +1056,13 @@ void max_thrackle_size_ot_file (int n, char *filename)
     for (i=0; i < num_ot_ids; i++) {
         db_seek (ot, ot_ids[i]);
 
-        mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&pool);
-        struct sequence_store_t seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
-        thrackle_search_tree (n, ot, &seq);
-        seq_tree_end (&seq);
+        int th[thrackle_size_upper_bound (n)];
+        uint64_t nodes;
+        int size = max_thrackle_bnb (n, ot, th, &nodes);
 
         progress_bar (i, num_ot_ids);
-        average += seq.num_nodes;
-        printf ("%u: %d\n", ot_ids[i], seq.final_max_len);
-
-        mem_pool_end_temporary_memory (mrk);
+        average += nodes;
+        printf ("%u: %d\n", ot_ids[i], size);
     }
     printf ("Average nodes: %f\n", average/(num_ot_ids));
     free (ot_ids);
@@ -512,7 +1222,7 @@ void get_thrackle_list_filename (char *s, int len, int n, int ot_id, int k)
 
 void get_all_thrackles (int n, int k, uint32_t ot_id, char* filename)
 {
-    assert (n<=10);
+    assert (n<=11);
     open_database (n);
     order_type_t *ot = order_type_new (n, NULL);
     db_seek (ot, ot_id);
@@ -635,10 +1345,11 @@ void average_search_nodes (int n, int *triangle_order)
     ot->n = n;
     ot->id = -1;
 
-    assert (n<=10);
+    assert (n<=11);
     open_database (n);
-    uint32_t ot_id = 0;
+    uint64_t ot_id = 0;
     db_seek (ot, ot_id);
+    db_prefetch_start (0);
 
     float nodes = 0;
 
@@ -647,11 +1358,12 @@ void average_search_nodes (int n, int *triangle_order)
         struct sequence_store_t seq = new_sequence_store (NULL, &temp_pool);
         thrackle_search_tree_full (n, ot, &seq, triangle_order);
         nodes += seq.num_nodes;
-        //printf ("%"PRIu32": %"PRIu32"\n", ot->id, seq.num_nodes);
+        //printf ("%"PRIu64": %"PRIu32"\n", ot->id, seq.num_nodes);
         seq_tree_end (&seq);
         db_next(ot);
         mem_pool_end_temporary_memory (mrk);
     }
+    db_prefetch_stop ();
     printf ("Average nodes: %f\n", nodes/((float)__g_db_data.num_order_types));
     mem_pool_destroy (&temp_pool);
 }
@@ -684,7 +1396,11 @@ void compare_convex_thrackle_orderings (int n, int k)
     printf ("Random avg (%d): %.2f\n", iters, avg/(float)iters);
 }
 
-int* get_all_thrackles_convex_position (int n, int k, int *num_found)
+// Returns the thrackles of size _k_ in the convex order type of _n_ points,
+// they are cached in the .cache/ directory. If they aren't cached they are
+// searched with _num_threads_ threads, 1 uses the sequential all_thrackles()
+// and 0 one thread per processor. The result is the same in all cases.
+int* get_all_thrackles_convex_position (int n, int k, int num_threads, int *num_found)
 {
     char filename[200];
     get_thrackle_list_filename (filename, ARRAY_SIZE(filename), n, 0, k);
@@ -701,7 +1417,11 @@ int* get_all_thrackles_convex_position (int n, int k, int *num_found)
         }
 
         struct sequence_store_t seq = new_sequence_store (filename, NULL);
-        all_thrackles (n, k, ot, &seq);
+        if (num_threads == 1) {
+            all_thrackles (n, k, ot, &seq);
+        } else {
+            all_thrackles_parallel (n, k, ot, &seq, num_threads);
+        }
         seq_end (&seq);
         res = seq_read_file (filename, NULL, &info, NULL);
     }
@@ -709,11 +1429,52 @@ int* get_all_thrackles_convex_position (int n, int k, int *num_found)
     return res;
 }
 
+// Enumerates the thrackles of size _k_ in convex position up to rotations and
+// reflections, prints the number of representatives with each orbit size and
+// the total number of labeled thrackles recovered from them. Representatives
+// are stored in the .cache/ directory.
+void print_thrackle_orbits_convex_position (int n, int k)
+{
+    mem_pool_t pool = {0};
+    order_type_t *ot = order_type_new (n, &pool);
+    if (n<=10) {
+        open_database (n);
+        db_seek (ot, 0);
+    } else {
+        convex_ot_searchable (ot);
+    }
+
+    triangle_group_t grp;
+    dihedral_triangle_group (ot, &grp, &pool);
+    uint64_t orbit_size_count[grp.num_perms+1];
+    int i;
+    for (i=0; i<=grp.num_perms; i++) {
+        orbit_size_count[i] = 0;
+    }
+
+    char filename[200];
+    snprintf (filename, ARRAY_SIZE(filename), ".cache/n_%d-ot_0-th_canonical-k_%d.bin", n, k);
+    struct sequence_store_t seq = new_sequence_store (filename, NULL);
+    all_thrackles_canonical (n, k, ot, &grp, &seq, orbit_size_count);
+    seq_end (&seq);
+
+    uint64_t num_reps = 0, num_labeled = 0;
+    for (i=1; i<=grp.num_perms; i++) {
+        if (orbit_size_count[i] > 0) {
+            printf ("Orbit size %d: %"PRIu64"\n", i, orbit_size_count[i]);
+        }
+        num_reps += orbit_size_count[i];
+        num_labeled += i*orbit_size_count[i];
+    }
+    printf ("Representatives: %"PRIu64", Labeled thrackles: %"PRIu64"\n", num_reps, num_labeled);
+    mem_pool_destroy (&pool);
+}
+
 void print_triangle_sizes_for_thrackles_in_convex_position (int n)
 {
     int k = thrackle_size (n);
     int num_found;
-    int *thrackles = get_all_thrackles_convex_position (n, k, &num_found);
+    int *thrackles = get_all_thrackles_convex_position (n, k, 0, &num_found);
     int i;
     for (i=0; i<num_found*k; i+=k) {
         int *thrackle = &thrackles[i];
@@ -757,7 +1518,7 @@ void print_triangle_edge_sizes_for_thrackles_in_convex_position (int n)
 {
     int k = thrackle_size (n);
     int num_found;
-    int *thrackles = get_all_thrackles_convex_position (n, k, &num_found);
+    int *thrackles = get_all_thrackles_convex_position (n, k, 0, &num_found);
     int i;
     for (i=0; i<num_found*k; i+=k) {
         int *thrackle = &thrackles[i];
@@ -1264,10 +2025,228 @@ void print_arr_min_max (char *filename)
     }
 }
 
-int main ()
+// Runs the full search tree, the branch and bound search and the maximum
+// clique solver on the first _num_ots_ order types of size _n_, or on all of
+// them if it's 0. Prints the order types where the size or the number of
+// maximum thrackles differ, and the time and nodes used by each engine.
+void benchmark_max_thrackle_engines (int n, uint64_t num_ots)
+{
+    mem_pool_t pool = {0};
+    open_database (n);
+    if (num_ots == 0 || num_ots > db_num_order_types (n)) {
+        num_ots = db_num_order_types (n);
+    }
+
+    order_type_t *ot = order_type_new (n, &pool);
+    db_seek (ot, 0);
+
+    struct timespec begin, end;
+    float tree_time = 0, bnb_time = 0, clique_time = 0;
+    double tree_nodes = 0, bnb_nodes = 0, clique_nodes = 0;
+    uint64_t mismatches = 0;
+    int th[thrackle_size_upper_bound (n)];
+
+    uint64_t id;
+    for (id=0; id<num_ots; id++) {
+        mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&pool);
+
+        clock_gettime (CLOCK_MONOTONIC, &begin);
+        struct sequence_store_t seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
+        thrackle_search_tree_full (n, ot, &seq, NULL);
+        seq_tree_end (&seq);
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        tree_time += time_elapsed_in_ms (&begin, &end);
+        tree_nodes += seq.num_nodes;
+
+        uint64_t nodes;
+        clock_gettime (CLOCK_MONOTONIC, &begin);
+        int bnb_size = max_thrackle_bnb (n, ot, th, &nodes);
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        bnb_time += time_elapsed_in_ms (&begin, &end);
+        bnb_nodes += nodes;
+
+        clock_gettime (CLOCK_MONOTONIC, &begin);
+        struct sequence_store_t all = new_sequence_store (NULL, &pool);
+        int clique_size = thrackle_max_clique (n, ot, th, &all, &nodes);
+        seq_end (&all);
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        clique_time += time_elapsed_in_ms (&begin, &end);
+        clique_nodes += nodes;
+
+        uint64_t tree_count = seq.nodes_per_len[seq.final_max_len];
+        if (bnb_size != seq.final_max_len || clique_size != seq.final_max_len ||
+            all.num_sequences != tree_count) {
+            printf ("%"PRIu64": tree %u (%"PRIu64"), branch and bound %d, clique %d (%u)\n",
+                    id, seq.final_max_len, tree_count, bnb_size, clique_size, all.num_sequences);
+            mismatches++;
+        }
+
+        progress_bar (id, num_ots);
+        db_next (ot);
+        mem_pool_end_temporary_memory (mrk);
+    }
+
+    printf ("Order types: %"PRIu64", mismatches: %"PRIu64"\n", num_ots, mismatches);
+    printf ("Full tree:        %.2f ms, average nodes: %.1f\n", tree_time, tree_nodes/num_ots);
+    printf ("Branch and bound: %.2f ms, average nodes: %.1f\n", bnb_time, bnb_nodes/num_ots);
+    printf ("Maximum clique:   %.2f ms, average nodes: %.1f (all maximum thrackles)\n",
+            clique_time, clique_nodes/num_ots);
+    mem_pool_destroy (&pool);
+}
+
+// Prints the decoding throughput of the full database of order types of size
+// _n_, using db_next() and the batch decoder with each available SIMD kernel.
+// Every method makes 3 passes over the database and we keep the fastest one, so
+// the first pass warms up the page cache.
+void benchmark_db_decode (int n)
+{
+    mem_pool_t pool = {0};
+    open_database (n);
+    uint64_t num_order_types = db_num_order_types (n);
+
+    struct timespec begin, end;
+    uint64_t checksum = 0;
+    float best = INFINITY;
+    int rep;
+
+    order_type_t *ot = order_type_new (n, &pool);
+    for (rep=0; rep<3; rep++) {
+        clock_gettime (CLOCK_MONOTONIC, &begin);
+        open_database (n);
+        db_next (ot);
+        while (!db_is_eof ()) {
+            checksum += ot->pts[n-1].x;
+            db_next (ot);
+        }
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        best = MIN (best, time_elapsed_in_ms (&begin, &end));
+    }
+    printf ("n=%d db_next(): %.2f M order types/s\n", n, num_order_types/(best*1000));
+
+    char *names[] = {"", "scalar", "SSE4.1", "AVX2"};
+    uint32_t batch_size = 4096;
+    ot_batch_t *batch = ot_batch_new (n, batch_size, &pool);
+    enum db_simd_t simd;
+    for (simd=DB_SIMD_SCALAR; simd<=DB_SIMD_AVX2; simd++) {
+        if (!db_set_simd (simd)) {
+            printf ("n=%d db_read_batch() %s: not supported\n", n, names[simd]);
+            continue;
+        }
+
+        best = INFINITY;
+        for (rep=0; rep<3; rep++) {
+            clock_gettime (CLOCK_MONOTONIC, &begin);
+            uint64_t id = 0;
+            while (id < num_order_types) {
+                uint32_t count = db_read_batch (id, batch_size, batch);
+                if (count == 0) {
+                    printf ("Could not read order type %"PRIu64".\n", id);
+                    break;
+                }
+                id += count;
+                checksum += batch->x[count*n-1];
+            }
+            clock_gettime (CLOCK_MONOTONIC, &end);
+            best = MIN (best, time_elapsed_in_ms (&begin, &end));
+        }
+        printf ("n=%d db_read_batch() %s: %.2f M order types/s\n",
+                n, names[simd], num_order_types/(best*1000));
+    }
+    db_set_simd (DB_SIMD_AUTO);
+
+    // NOTE: Printing the checksum keeps the compiler from removing the loops.
+    printf ("checksum: %"PRIu64"\n", checksum);
+    mem_pool_destroy (&pool);
+}
+
+// Checks that the parallel thrackle search gives the same results as the
+// sequential one on every order type of size _n_. Both the statistics of
+// thrackle_search_tree_parallel() and the thrackles of maximum size found by
+// all_thrackles_parallel() are compared. Returns the number of order types
+// where they differ.
+uint64_t verify_thrackle_search_parallel (int n, int num_threads)
+{
+    mem_pool_t pool = {0};
+    order_type_t *ot = order_type_new (n, &pool);
+    int k = thrackle_size (n);
+
+    char filename[50], par_filename[50];
+    snprintf (filename, ARRAY_SIZE(filename), ".cache/n_%d_verify_all_thrackles.bin", n);
+    snprintf (par_filename, ARRAY_SIZE(par_filename), ".cache/n_%d_verify_all_thrackles_parallel.bin", n);
+
+    open_database (n);
+    uint64_t num_order_types = db_num_order_types (n);
+    uint64_t num_differ = 0;
+    uint64_t id;
+    for (id=0; id<num_order_types; id++) {
+        db_seek (ot, id);
+        mem_pool_marker_t mrk = mem_pool_begin_temporary_memory (&pool);
+
+        struct sequence_store_t seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
+        thrackle_search_tree (n, ot, &seq);
+        seq_tree_end (&seq);
+
+        struct sequence_store_t par_seq = new_sequence_store_opts (NULL, &pool, SEQ_DRY_RUN);
+        thrackle_search_tree_parallel (n, ot, &par_seq, num_threads);
+        seq_tree_end (&par_seq);
+
+        bool differ = seq.num_nodes != par_seq.num_nodes ||
+            seq.num_sequences != par_seq.num_sequences ||
+            seq.final_max_len != par_seq.final_max_len ||
+            memcmp (seq.nodes_per_len, par_seq.nodes_per_len, (k+1)*sizeof(uint64_t)) != 0 ||
+            memcmp (seq.leaves_per_len, par_seq.leaves_per_len, (k+1)*sizeof(uint64_t)) != 0;
+
+        struct sequence_store_t all = new_sequence_store (filename, NULL);
+        all_thrackles (n, k, ot, &all);
+        seq_end (&all);
+        struct file_header_t info;
+        int *thrackles = seq_read_file (filename, &pool, &info, NULL);
+
+        struct sequence_store_t par_all = new_sequence_store (par_filename, NULL);
+        all_thrackles_parallel (n, k, ot, &par_all, num_threads);
+        seq_end (&par_all);
+        struct file_header_t par_info;
+        int *par_thrackles = seq_read_file (par_filename, &pool, &par_info, NULL);
+
+        if (info.num_sequences != par_info.num_sequences ||
+            memcmp (thrackles, par_thrackles, info.num_sequences*k*sizeof(int)) != 0) {
+            differ = true;
+        }
+
+        if (differ) {
+            printf ("Parallel search differs on order type %"PRIu64".\n", id);
+            num_differ++;
+        }
+        mem_pool_end_temporary_memory (mrk);
+    }
+
+    remove (filename);
+    remove (par_filename);
+    printf ("Checked %"PRIu64" order types of size %d, %"PRIu64" differ.\n",
+            num_order_types, n, num_differ);
+    mem_pool_destroy (&pool);
+    return num_differ;
+}
+
+int main (int argc, char **argv)
 {
     ensure_full_database ();
-    //get_thrackle_for_each_ot (10, 12);
+
+    if (argc == 3 && strcmp (argv[1], "--benchmark-db-decode") == 0) {
+        benchmark_db_decode (atoi (argv[2]));
+        return 0;
+    } else if ((argc == 3 || argc == 4) && strcmp (argv[1], "--benchmark-max-thrackle") == 0) {
+        benchmark_max_thrackle_engines (atoi (argv[2]), argc == 4 ? strtoull (argv[3], NULL, 10) : 0);
+        return 0;
+    } else if ((argc == 3 || argc == 4) && strcmp (argv[1], "--verify-parallel-search") == 0) {
+        return verify_thrackle_search_parallel (atoi (argv[2]), argc == 4 ? atoi (argv[3]) : 0) == 0 ? 0 : 1;
+    } else if (argc > 1) {
+        printf ("Usage: %s [--benchmark-db-decode N | --benchmark-max-thrackle N [NUM_OTS] |\n"
+                "          --verify-parallel-search N [NUM_THREADS]]\n", argv[0]);
+        return 1;
+    }
+
+    //get_thrackle_for_each_ot (10, 12, false);
     //count_thrackles (8);
     //print_differing_triples (n, 0, 1);
     //print_edge_disjoint_sets (5, 2);
@@ -1291,6 +2270,7 @@ int main ()
 
     //get_all_thrackles (9, 10, 0, NULL);
     //print_triangle_sizes_for_thrackles_in_convex_position (7);
+    //print_thrackle_orbits_convex_position (10, thrackle_size (10));
 
     //compare_convex_thrackle_orderings (10, 12);
     //print_lex_edg_triangles (10);
@@ -1316,8 +2296,16 @@ int main ()
     //print_maximal_thrackles (n, 3017, rand_arr, TRIANGLE_SET_ID);
 
     //search_full_tree_all_ot (8, STATS_PRINT|FIRST_THRACKLE);
+    //search_full_tree_all_ot_parallel (9, STATS_PRINT, 0);
+    //search_full_tree_all_ot (8, STATS_PRINT|UNLABELED);
+    //search_full_tree_all_ot (8, STATS_PRINT|INCREMENTAL);
+    //search_sharded (10, SHARD_JOB_MAX_THRACKLE_SIZE, 0, STATS_PRINT|COUNT_PER_THRACKLE_FILE);
     //print_arr_min_max ("./.cache/n_8_thrackle_count.bin");
 
+    //ot_index_build_all (0);
+    //ot_pack_write (10, 0);
+    //arranged_db_build_all (0);
+
     //int count = count_2_regular_subgraphs_of_k_n_n (4, NULL);
     //printf ("Total: %d\n", count);
 }
@@ -706,7 +706,7 @@ int* seq_end (struct sequence_store_t *stor)
         int_dyn_arr_destroy (&stor->dyn_arr);
     }
 
-    if (stor->file) {
+    if (stor->filename != NULL) {
         struct file_header_t header = {0};
         header.type = stor->type;
         header.custom_header_size = stor->custom_file_header_size;